@@ -0,0 +1,180 @@
+/*
+ * measures how fast every tag scan variant goes through a noisy
+ * syslog sample where only one line in a thousand is a knock,
+ * each variant has to find every tagged line to count
+ *
+ * build and run from the repository root:
+ * 	gcc -O2 -Wall -o tag_scan_bench bench/tag_scan_bench.c
+ * 	./tag_scan_bench [megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../src/tag_scan.h"
+
+
+#define BENCH_DEFAULT_MB 256
+#define BENCH_ROUNDS 5
+#define BENCH_TAG "Speakeasy-log"
+
+
+//the kinds of lines a busy host writes to syslog
+static const char* _bench_lines[] =
+{
+	"Oct 18 07:08:09 web01 systemd[1]: Started Session 4821 of user deploy.\n",
+	"Oct 18 07:08:09 web01 sshd[20417]: Accepted publickey for deploy from 10.20.0.7 port 50112 ssh2: RSA SHA256:q3Xb4mS0\n",
+	"Oct 18 07:08:09 web01 CRON[20455]: (root) CMD (command -v debian-sa1 > /dev/null && debian-sa1 1 1)\n",
+	"Oct 18 07:08:09 web01 kernel: [81234.567891] [UFW BLOCK] IN=eth0 OUT= MAC=52:54:00:12:34:56 SRC=203.0.113.9 DST=10.0.0.2 LEN=40 TOS=0x00 PROTO=TCP SPT=44321 DPT=3389 WINDOW=1024 SYN URGP=0\n",
+	"Oct 18 07:08:09 web01 nginx[1022]: 2026/10/18 07:08:09 [warn] 1022#1022: *88131 upstream response is buffered to a temporary file\n",
+	"Oct 18 07:08:09 web01 dockerd[911]: time=\"2026-10-18T07:08:09.114Z\" level=info msg=\"ignoring event\" module=libcontainerd namespace=moby\n",
+	"Oct 18 07:08:09 web01 systemd-resolved[604]: Using degraded feature set UDP instead of UDP+EDNS0 for DNS server 10.0.0.1.\n",
+};
+
+static const char* _bench_knock =
+	"Oct 18 07:08:09 web01 kernel: [81234.600001] [Speakeasy-log]: IN=eth0 OUT= MAC=52:54:00:12:34:56 SRC=198.51.100.4 DST=10.0.0.2 LEN=60 TOS=0x00 PROTO=TCP SPT=51000 DPT=1000 WINDOW=64240 SYN URGP=0\n";
+
+
+/*
+ * fills a buffer of size bytes with syslog lines, returns
+ * the number of tagged lines it holds
+ */
+unsigned int build_sample(char* buffer, size_t size)
+{
+	size_t used = 0;
+	unsigned int lines = 0;
+	unsigned int tagged = 0;
+	unsigned int numLines = sizeof(_bench_lines) / sizeof(_bench_lines[0]);
+
+	while(1)
+	{
+		const char* line = (lines % 1000 == 999) ? _bench_knock : _bench_lines[(lines * 7 + lines / 13) % numLines];
+		size_t len = strlen(line);
+
+		if(used + len > size)
+			break;
+
+		memcpy(buffer + used, line, len);
+		used += len;
+		tagged += line == _bench_knock;
+		lines++;
+	}
+
+	memset(buffer + used, '\n', size - used);
+	return tagged;
+}
+
+
+/*
+ * returns the current time in seconds
+ */
+double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * scans the sample with one variant, prints its rate
+ * and returns the number of tags it found
+ */
+unsigned int bench_variant(const char* name, TagScanFunction scan, const char* buffer, size_t size)
+{
+	size_t tagLen = strlen(BENCH_TAG);
+	unsigned int found = 0;
+	double best = 0;
+
+	for(unsigned int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		found = 0;
+		double start = now_seconds();
+
+		const char* cursor = buffer;
+		const char* end = buffer + size;
+		const char* hit;
+		while((hit = scan(cursor, end - cursor, BENCH_TAG, tagLen)) != NULL)
+		{
+			found++;
+			cursor = hit + tagLen;
+		}
+
+		double elapsed = now_seconds() - start;
+		if(best == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	printf("%-8s %8.2f GB/s  %u tags\n", name, size / best / 1e9, found);
+	return found;
+}
+
+
+/*
+ * the per line getline and strstr scan the syslog backend used to do,
+ * run over the sample in memory so only the search itself is measured
+ */
+const char* strstr_lines(const char* buf, size_t len, const char* tag, size_t tagLen)
+{
+	const char* end = buf + len;
+	char line[512];
+
+	while(buf < end)
+	{
+		const char* newline = memchr(buf, '\n', end - buf);
+		size_t lineLen = (newline != NULL) ? (size_t) (newline - buf) : (size_t) (end - buf);
+		size_t copyLen = (lineLen < sizeof(line)) ? lineLen : sizeof(line) - 1;
+
+		memcpy(line, buf, copyLen);
+		line[copyLen] = '\0';
+
+		char* hit = strstr(line, tag);
+		if(hit != NULL)
+			return buf + (hit - line);
+
+		buf += lineLen + 1;
+	}
+
+	return NULL;
+}
+
+
+int main(int argc, char** argv)
+{
+	size_t megabytes = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MB;
+	if(megabytes == 0)
+		megabytes = BENCH_DEFAULT_MB;
+
+	size_t size = megabytes * 1024 * 1024;
+	char* buffer = (char*) malloc(size);
+	if(buffer == NULL)
+	{
+		fprintf(stderr, "Failed to allocate %zu MB sample\n", megabytes);
+		return 1;
+	}
+
+	unsigned int expected = build_sample(buffer, size);
+	printf("sample: %zu MB, %u tagged lines\n", megabytes, expected);
+
+	unsigned int status = 0;
+	status |= bench_variant("strstr", strstr_lines, buffer, size) != expected;
+	status |= bench_variant("scalar", tag_scan_scalar, buffer, size) != expected;
+
+#ifdef TAG_SCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2"))
+		status |= bench_variant("sse2", tag_scan_sse2, buffer, size) != expected;
+	if(__builtin_cpu_supports("avx2"))
+		status |= bench_variant("avx2", tag_scan_avx2, buffer, size) != expected;
+#endif
+
+	status |= bench_variant("dispatch", tag_scan, buffer, size) != expected;
+
+	if(status)
+		fprintf(stderr, "A scan variant missed or invented tags\n");
+
+	free(buffer);
+	return status;
+}
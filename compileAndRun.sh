@@ -1,2 +1,3 @@
-gcc -Wall -o speakeasy src/speakeasy.c
+gcc -Wall -o speakeasy src/speakeasy.c -ldl -pthread
+gcc -Wall -o speakeasy-ctl src/speakeasy_ctl.c
 sudo ./speakeasy
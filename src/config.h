@@ -1,3 +1,25 @@
+/*
+ * these are the possible values of logBackend in config.txt:
+ * 	-syslog reads LOG target messages from one of logLocations
+ * 	-nflog reads packets from an NFLOG group over netlink
+ * 	-packet captures SYNs to the knock ports with an AF_PACKET socket
+ * 	-journal reads LOG target messages from the systemd journal
+ */
+#define LOG_BACKEND_SYSLOG 0
+#define LOG_BACKEND_NFLOG 1
+#define LOG_BACKEND_PACKET 2
+#define LOG_BACKEND_JOURNAL 3
+
+
+/*
+ * these are the possible values of firewallBackend in config.txt:
+ * 	-iptables shells out to iptables, iptables-restore and ipset
+ * 	-nftables talks to nf_tables over netlink in its own table
+ */
+#define FIREWALL_BACKEND_IPTABLES 0
+#define FIREWALL_BACKEND_NFTABLES 1
+
+
 /*
  * this struct houses all of the information located
  * inside of the config.txt file, as well as 2 file handles:
@@ -10,8 +32,17 @@ typedef struct
 	unsigned int interval;
 	char firewallResponse[8];
 	char** portsToKnock;
+	char** knockSequences;
+	KnockProgram* knockProgram;
 	char** blacklistPorts;
 	char** logLocations;
+	unsigned int logBackend;
+	unsigned int nflogGroup;
+	unsigned int firewallBackend;
+	char* journalDirectory;
+	unsigned int logLevel;
+	char* metricsFile;
+	unsigned int metricsInterval;
 	char* logPath;
 	FILE* logFile;
 	FILE* whitelistFile;
@@ -28,7 +59,7 @@ void choose_log_file(Config* cfg)
 {
 	if(cfg->logLocations == NULL)
 	{
-		write_log("Configuration failed due to logLocations parameter, try deleting config.txt to restore default");
+		write_error("Configuration failed due to logLocations parameter, try deleting config.txt to restore default");
 		return;
 	}
 
@@ -58,7 +89,30 @@ void choose_log_file(Config* cfg)
 		}
 		index++;
 	}
-	write_log("No valid log files located, are you sure you set logLocations correctly in config?");
+	write_error("No valid log files located, are you sure you set logLocations correctly in config?");
+}
+
+
+/*
+ * reopens the log file at logPath after the old one was rotated
+ * away, reading starts from the beginning of the new file since
+ * everything in it is new, returns 1 if successful otherwise 0
+ */
+unsigned int reopen_log_file(Config* cfg)
+{
+	if(cfg == NULL || cfg->logPath == NULL)
+		return 0;
+	
+	FILE* file = read_file(cfg->logPath);
+	if(file == NULL)
+		return 0;
+	
+	if(cfg->logFile != NULL)
+		fclose(cfg->logFile);
+	
+	cfg->logFile = file;
+	write_log_two("Reopened rotated log file: ", cfg->logPath);
+	return 1;
 }
 
 
@@ -79,6 +133,14 @@ void free_config(Config* cfg)
 
 	free_all_double_char(ptrs, 3);
 	
+	if(cfg->knockSequences != NULL)
+		free_all_double_char((char**[]) {cfg->knockSequences}, 1);
+	
+	free_knock_program(cfg->knockProgram);
+	free(cfg->knockProgram);
+	free(cfg->journalDirectory);
+	free(cfg->metricsFile);
+	
 	//free log handle
 	if(cfg->logFile != NULL)
 		fclose(cfg->logFile);
@@ -104,11 +166,15 @@ int initialize_config_files(Config* cfg)
 	//if they haven't been initialized when struct is freed
 	cfg->logFile = NULL;
 	cfg->whitelistFile = NULL;
+	cfg->logPath = NULL;
 	
-	//obtain log handle
-	choose_log_file(cfg);
-	if(cfg->logFile == NULL)
-		return 0;
+	//obtain log handle, only needed when reading from syslog
+	if(cfg->logBackend == LOG_BACKEND_SYSLOG)
+	{
+		choose_log_file(cfg);
+		if(cfg->logFile == NULL)
+			return 0;
+	}
 	
 	//obtain whitelistFile handle
 	FILE* whitelistFile = read_file("whitelist.txt");
@@ -121,6 +187,52 @@ int initialize_config_files(Config* cfg)
 }
 
 
+/*
+ * turns the logBackend parameter into one of the LOG_BACKEND values,
+ * a missing parameter means syslog so older config files keep working,
+ * returns -1 if the backend is unknown
+ */
+int parse_log_backend(char* logBackend)
+{
+	if(logBackend == NULL)
+		return LOG_BACKEND_SYSLOG;
+	
+	logBackend[strcspn(logBackend, "\n")] = '\0';
+	
+	if(strcmp(logBackend, "syslog") == 0)
+		return LOG_BACKEND_SYSLOG;
+	if(strcmp(logBackend, "nflog") == 0)
+		return LOG_BACKEND_NFLOG;
+	if(strcmp(logBackend, "packet") == 0)
+		return LOG_BACKEND_PACKET;
+	if(strcmp(logBackend, "journal") == 0)
+		return LOG_BACKEND_JOURNAL;
+	
+	return -1;
+}
+
+
+/*
+ * turns the firewallBackend parameter into one of the FIREWALL_BACKEND
+ * values, a missing parameter means iptables, returns -1 if the
+ * backend is unknown
+ */
+int parse_firewall_backend(char* firewallBackend)
+{
+	if(firewallBackend == NULL)
+		return FIREWALL_BACKEND_IPTABLES;
+	
+	firewallBackend[strcspn(firewallBackend, "\n")] = '\0';
+	
+	if(strcmp(firewallBackend, "iptables") == 0)
+		return FIREWALL_BACKEND_IPTABLES;
+	if(strcmp(firewallBackend, "nftables") == 0)
+		return FIREWALL_BACKEND_NFTABLES;
+	
+	return -1;
+}
+
+
 /*
  * constructs a config struct using the 
  * config file otherwise returns null
@@ -131,7 +243,7 @@ Config* construct_config(FILE* fptr)
 {
 	if(fptr == NULL)
 	{
-		write_log("Failed to obtain handle on config file: exiting");
+		write_error("Failed to obtain handle on config file: exiting");
 		return NULL;
 	}
 	
@@ -151,6 +263,58 @@ Config* construct_config(FILE* fptr)
 	if(check_ptr_integrity(ptrs, 6) == 0)
 		return NULL;
 	
+	//optional parameters which older config files don't have
+	char* logBackend = parse_for_parameter(fptr, "logBackend=");
+	char* nflogGroup = parse_for_parameter(fptr, "nflogGroup=");
+	char* firewallBackend = parse_for_parameter(fptr, "firewallBackend=");
+	char** knockSequences = parse_for_parameters(fptr, "knockSequence=");
+	char* journalDirectory = parse_for_parameter(fptr, "journalDirectory=");
+	char* logLevel = parse_for_parameter(fptr, "logLevel=");
+	char* metricsFile = parse_for_parameter(fptr, "metricsFile=");
+	char* metricsInterval = parse_for_parameter(fptr, "metricsInterval=");
+	
+	//an empty journalDirectory means the system journal
+	if(journalDirectory != NULL)
+	{
+		journalDirectory[strcspn(journalDirectory, "\n")] = '\0';
+		if(journalDirectory[0] == '\0')
+		{
+			free(journalDirectory);
+			journalDirectory = NULL;
+		}
+	}
+	
+	//an empty metricsFile means no metrics are written
+	if(metricsFile != NULL)
+	{
+		metricsFile[strcspn(metricsFile, "\n")] = '\0';
+		if(metricsFile[0] == '\0')
+		{
+			free(metricsFile);
+			metricsFile = NULL;
+		}
+	}
+	
+	int metricsSeconds = (metricsInterval != NULL) ? atoi(metricsInterval) : METRICS_DEFAULT_INTERVAL;
+	free(metricsInterval);
+	
+	int backend = parse_log_backend(logBackend);
+	unsigned int group = (nflogGroup != NULL) ? atoi(nflogGroup) : 0;
+	int fwBackend = parse_firewall_backend(firewallBackend);
+	int level = parse_log_level(logLevel);
+	free_all((void*[]) {logBackend, nflogGroup, firewallBackend, logLevel}, 4);
+	
+	if(backend == -1 || group > 65535 || fwBackend == -1 || level == -1 || metricsSeconds <= 0)
+	{
+		write_error("Configuration failed due to logBackend, nflogGroup, firewallBackend, logLevel or metricsInterval parameter");
+		free_all(ptrs, 6);
+		if(knockSequences != NULL)
+			free_all_double_char((char**[]) {knockSequences}, 1);
+		free(journalDirectory);
+		free(metricsFile);
+		return NULL;
+	}
+	
 	//allocate memory
 	Config* cfg = (Config*) malloc(sizeof(Config));
 	
@@ -164,6 +328,15 @@ Config* construct_config(FILE* fptr)
 	//instantiate static members of struct
 	cfg->timeout = atoi(timeoutStr);
 	cfg->interval = atoi(intervalStr);
+	cfg->logBackend = backend;
+	cfg->nflogGroup = group;
+	cfg->firewallBackend = fwBackend;
+	cfg->knockSequences = knockSequences;
+	cfg->knockProgram = NULL;
+	cfg->journalDirectory = journalDirectory;
+	cfg->logLevel = level;
+	cfg->metricsFile = metricsFile;
+	cfg->metricsInterval = metricsSeconds;
 		
 	//copy and null terminate firewallResponse:
 	//this is because firewallResponse possibly contains a newline
@@ -179,14 +352,15 @@ Config* construct_config(FILE* fptr)
 	
 	//sanitize items
 	sanitize_array_dyn(cfg->portsToKnock);
+	sanitize_array_dyn(cfg->knockSequences);
 	sanitize_array_dyn(cfg->blacklistPorts);
 	sanitize_dyn(cfg->firewallResponse);
 	
 	//check to make sure results of str series to double charptr is valid
 	void* dCharPtrs[] = {cfg->portsToKnock, cfg->blacklistPorts,
-						 cfg->logLocations};
+						 cfg->logLocations, cfg->knockSequences};
 	
-	if(check_ptr_integrity(dCharPtrs, 3) == 0)
+	if(check_ptr_integrity(dCharPtrs, 4) == 0)
 		return NULL;
 	
 	//free pointers that are no longer required
@@ -198,6 +372,15 @@ Config* construct_config(FILE* fptr)
 		return NULL;
 	}
 	
+	//compile every knock sequence into one trie
+	cfg->knockProgram = (KnockProgram*) calloc(1, sizeof(KnockProgram));
+	if(compile_knock_program(cfg->portsToKnock, cfg->knockSequences, cfg->knockProgram) == 0)
+	{
+		write_error("Configuration failed due to portsToKnock or knockSequence parameters, each sequence needs a name and two or more ports from 1-65535");
+		free_config(cfg);
+		return NULL;
+	}
+	
 	return cfg;
 }
 
@@ -221,12 +404,24 @@ void print_config(Config* cfg)
 	print_str_array(cfg->portsToKnock);
 	newline();
 	
+	printf("knockSequences: ");
+	print_str_array(cfg->knockSequences);
+	newline();
+	
 	printf("blacklistPorts: ");
 	print_str_array(cfg->blacklistPorts);
 	newline();
 	
 	printf("logLocations: ");
 	print_str_array(cfg->logLocations);
+	newline();
+	
+	printf("logBackend: %d\nnflogGroup: %d\n", cfg->logBackend, cfg->nflogGroup);
+	printf("firewallBackend: %d\n", cfg->firewallBackend);
+	printf("journalDirectory: %s", (cfg->journalDirectory != NULL) ? cfg->journalDirectory : "");
+	printf("\nlogLevel: %u", cfg->logLevel);
+	printf("\nmetricsFile: %s", (cfg->metricsFile != NULL) ? cfg->metricsFile : "");
+	printf("\nmetricsInterval: %u", cfg->metricsInterval);
 
 	//print newline
 	printf("\n");
@@ -0,0 +1,269 @@
+//where speakeasy-ctl finds the running server, next to the other files
+#define CONTROL_SOCKET_FILE "speakeasy.sock"
+
+//longest request line a client may send
+#define CONTROL_REQUEST_SIZE 256
+
+//how often a waiting request pokes the main loop again in case
+//the first wakeup came right before it went back to sleep
+#define CONTROL_WAKE_MS 100
+
+//a client that stalls this long is dropped so others aren't held up
+#define CONTROL_CLIENT_TIMEOUT 2
+
+
+/*
+ * this struct houses the control socket, a thread accepts clients and
+ * reads their request so none of the log backends has to watch one more
+ * file descriptor, the request itself is handed to the main thread
+ * because only it may touch the host table, whitelist and firewall:
+ * 	-the thread stores the request, sets pending and sends the
+ * 	 main thread SIGUSR1 so whatever it blocks on returns early
+ * 	-the main thread answers it in poll_control_socket at the end of
+ * 	 its next pass, clears pending and signals answered
+ */
+typedef struct
+{
+	int fd;
+	char path[108];
+	unsigned int running;
+	pthread_t thread;
+	pthread_t mainThread;
+	pthread_mutex_t lock;
+	pthread_cond_t answered;
+	char request[CONTROL_REQUEST_SIZE];
+	unsigned int pending;
+	char* response;
+	size_t responseLength;
+} ControlSocket;
+
+ControlSocket _control_socket = {.fd = -1};
+
+
+/*
+ * reads one request line from a client into request without
+ * its newline, returns 1 if successful otherwise 0
+ */
+unsigned int read_control_request(int client, char* request, size_t size)
+{
+	size_t length = 0;
+
+	while(length < size - 1)
+	{
+		ssize_t len = recv(client, request + length, size - 1 - length, 0);
+		if(len == -1 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return 0;
+
+		char* newline = memchr(request + length, '\n', len);
+		length += len;
+
+		if(newline != NULL)
+		{
+			*newline = '\0';
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * writes a whole response to a client, a client that went away
+ * is not an error worth reporting
+ */
+void send_control_response(int client, const char* data, size_t length)
+{
+	while(length > 0)
+	{
+		ssize_t len = send(client, data, length, MSG_NOSIGNAL);
+		if(len == -1 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return;
+
+		data += len;
+		length -= len;
+	}
+}
+
+
+/*
+ * hands one request to the main thread and waits for its response,
+ * returns the response or NULL if there wasn't one
+ *
+ * side effect: must free returned pointer
+ */
+char* forward_control_request(ControlSocket* control, char* request, size_t* length)
+{
+	pthread_mutex_lock(&control->lock);
+
+	snprintf(control->request, sizeof(control->request), "%s", request);
+	control->response = NULL;
+	control->responseLength = 0;
+	__atomic_store_n(&control->pending, 1, __ATOMIC_RELEASE);
+
+	while(control->pending)
+	{
+		pthread_kill(control->mainThread, SIGUSR1);
+
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += CONTROL_WAKE_MS * 1000000L;
+		if(until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+
+		pthread_cond_timedwait(&control->answered, &control->lock, &until);
+	}
+
+	char* response = control->response;
+	*length = control->responseLength;
+	control->response = NULL;
+
+	pthread_mutex_unlock(&control->lock);
+	return response;
+}
+
+
+/*
+ * accepts clients one after the other until the socket is closed
+ */
+void* control_thread(void* arg)
+{
+	ControlSocket* control = (ControlSocket*) arg;
+
+	while(1)
+	{
+		int client = accept(control->fd, NULL, NULL);
+		if(client == -1 && (errno == EINTR || errno == ECONNABORTED))
+			continue;
+		if(client == -1)
+			break;
+
+		struct timeval timeout = {.tv_sec = CONTROL_CLIENT_TIMEOUT};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		char request[CONTROL_REQUEST_SIZE];
+		if(read_control_request(client, request, sizeof(request)) == 0)
+		{
+			const char* malformed = "error: expected one request line\n";
+			send_control_response(client, malformed, strlen(malformed));
+		}
+		else
+		{
+			size_t length;
+			char* response = forward_control_request(control, request, &length);
+
+			if(response != NULL)
+				send_control_response(client, response, length);
+			free(response);
+		}
+
+		close(client);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * creates the control socket at path and starts the thread that serves
+ * it, only its owner may connect since it can change the whitelist,
+ * requests are handed to the calling thread,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int open_control_socket(ControlSocket* control, const char* path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return 0;
+
+	strcpy(addr.sun_path, path);
+	snprintf(control->path, sizeof(control->path), "%s", path);
+
+	control->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(control->fd == -1)
+		return 0;
+
+	//a socket left behind by a crash would make bind fail
+	unlink(path);
+
+	mode_t mask = umask(0177);
+	int bound = bind(control->fd, (struct sockaddr*) &addr, sizeof(addr));
+	umask(mask);
+
+	if(bound == -1 || listen(control->fd, 8) == -1)
+	{
+		close(control->fd);
+		control->fd = -1;
+		return 0;
+	}
+
+	control->mainThread = pthread_self();
+	control->pending = 0;
+	pthread_mutex_init(&control->lock, NULL);
+	pthread_cond_init(&control->answered, NULL);
+
+	if(start_thread(&control->thread, control_thread, control) == 0)
+	{
+		close(control->fd);
+		control->fd = -1;
+		unlink(path);
+		return 0;
+	}
+
+	control->running = 1;
+	return 1;
+}
+
+
+/*
+ * answers the request waiting on the control socket, if there is one,
+ * with whatever handler writes, called by the main thread once a pass
+ */
+void poll_control_socket(ControlSocket* control, void (*handler)(char*, FILE*))
+{
+	if(control->running == 0 || __atomic_load_n(&control->pending, __ATOMIC_ACQUIRE) == 0)
+		return;
+
+	pthread_mutex_lock(&control->lock);
+
+	char* response = NULL;
+	size_t length = 0;
+	FILE* out = open_memstream(&response, &length);
+
+	if(out != NULL)
+	{
+		handler(control->request, out);
+		fclose(out);
+	}
+
+	control->response = response;
+	control->responseLength = length;
+	__atomic_store_n(&control->pending, 0, __ATOMIC_RELEASE);
+
+	pthread_cond_signal(&control->answered);
+	pthread_mutex_unlock(&control->lock);
+}
+
+
+/*
+ * removes the control socket so clients fail right away instead of
+ * connecting to a server that's shutting down, the thread isn't
+ * waited for since it may be held up by a slow client right before exit
+ */
+void close_control_socket(ControlSocket* control)
+{
+	if(control->fd == -1)
+		return;
+
+	unlink(control->path);
+	shutdown(control->fd, SHUT_RDWR);
+	control->running = 0;
+}
@@ -242,79 +242,6 @@ long get_line_num(FILE* fptr, char* substring)
 }
 
 
-/*
- * returns line number of target substring
- * -1 for if substring not found
- * -2 if file pointer or substring are null
- * 
- * side effect: does not rewind the file pointer
- * unless the substring is not found up till EOF
- */
-long get_line_num_no_rewind(FILE* fptr, char* substring)
-{
-	if(fptr == NULL || substring == NULL)
-		return -2;
-	
-	char* line = NULL;
-	size_t len = 0;
-	long lineNumber = 0;
-
-	while(getline(&line, &len, fptr) != -1 && lineNumber < LONG_MAX)
-	{
-		lineNumber++;
-		if(strstr(line, substring) != NULL)
-		{
-			free(line);
-			return lineNumber;
-		}
-		
-		//free the memory associated with line
-		free(line);
-		line = NULL;
-		len = 0;
-	}
-	free(line);
-	return -1;
-}
-
-
-/*
- * returns line number of target substring
- * -1 for if substring not found
- * -2 if file pointer or substring are null
- * 
- * side effect: does not rewind the file pointer
- * instead if the substring cant be found it positions
- * the file pointer on the last line
- * unless the substring is not found up till EOF
- */
-char* get_line_no_rewind(FILE* fptr, char* substring)
-{
-	if(fptr == NULL || substring == NULL)
-		return NULL;
-	
-	char* line = NULL;
-	size_t len = 0;
-	long lineNumber = 0;
-
-	while(getline(&line, &len, fptr) != -1 && lineNumber < LONG_MAX)
-	{
-		if(strstr(line, substring) != NULL)
-			return line;
-		
-		//free the memory associated with line
-		free(line);
-		line = NULL;
-		len = 0;
-	}
-	
-	//go back a line if at end
-	free(line);
-	fseek(fptr, -1, SEEK_END);
-	return NULL;
-}
-
-
 /*
  * parses the file for a line containing a parameter
  * and then accesses that parameters contents
@@ -352,6 +279,55 @@ char* parse_for_parameter(FILE* fptr, char* substring)
 }
 
 
+/*
+ * works like parse_for_parameter but collects the parameter
+ * of every line containing substring, ex. lines "num=1" and
+ * "num=2" give {"1", "2", NULL}, returns null if either argument
+ * is null or allocation fails
+ *
+ * side effect: rewinds fptr, must free sub pointers and pointer
+ */
+char** parse_for_parameters(FILE* fptr, char* substring)
+{
+	if(fptr == NULL || substring == NULL)
+		return NULL;
+	
+	char** result = (char**) malloc(sizeof(char*));
+	unsigned int count = 0;
+	
+	char* line = NULL;
+	size_t len = 0;
+	
+	while(result != NULL && getline(&line, &len, fptr) != -1)
+	{
+		char* strParameter = get_parameter(line, substring);
+		if(strParameter == NULL)
+			continue;
+		
+		//grow by one, keeping room for the null sentinel
+		char** grown = (char**) realloc(result, sizeof(char*) * (count + 2));
+		if(grown == NULL)
+		{
+			free(strParameter);
+			result[count] = NULL;
+			free_all_double_char((char**[]) {result}, 1);
+			result = NULL;
+			break;
+		}
+		
+		result = grown;
+		result[count++] = strParameter;
+	}
+	
+	free(line);
+	rewind(fptr);
+	
+	if(result != NULL)
+		result[count] = NULL;
+	return result;
+}
+
+
 /*
  * parses the file line by line collecting each line
  * into a double character pointer, returns null if 
@@ -424,24 +400,6 @@ void print_file(FILE* fptr)
 }
 
 
-/* 
- * places the file pointer at the last line of a file
- * returns 1 if it is successful, otherwise 0
- */ 
-unsigned int skip_to_last_line(FILE* fptr)
-{
-	if(fptr == NULL)
-		return 0;
-	
-	//attempt to skip to end
-	fseek(fptr, -1, SEEK_END);
-	if(ferror(fptr))
-		return 0;
-	
-	return 1;
-}
-
-
 /*
  * removes a line from a file by line number
  * returns 1 if successful, otherwise 0
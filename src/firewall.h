@@ -1,58 +1,968 @@
+/*
+ * the target knock logging rules jump to, it depends on the log
+ * backend so it is filled in by set_firewall_log_target
+ */
+char _firewall_log_target[96] = "LOG --log-prefix \"[Speakeasy-log]: \" --log-level 4";
+
+
+/*
+ * points knock logging rules at the LOG target when reading from
+ * syslog or at an NFLOG group when reading packets over netlink,
+ * packet capture sees knocks before the firewall so it needs no
+ * logging rules at all and the target is left empty
+ */
+void set_firewall_log_target(Config* cfg)
+{
+	if(cfg == NULL)
+		return;
+	
+	if(cfg->logBackend == LOG_BACKEND_PACKET)
+		_firewall_log_target[0] = '\0';
+	else if(cfg->logBackend == LOG_BACKEND_NFLOG)
+		snprintf(_firewall_log_target, sizeof(_firewall_log_target),
+				 "NFLOG --nflog-group %u --nflog-prefix %s --nflog-size %u",
+				 cfg->nflogGroup, NFLOG_PREFIX, NFLOG_COPY_RANGE);
+	else
+		snprintf(_firewall_log_target, sizeof(_firewall_log_target),
+				 "LOG --log-prefix \"[Speakeasy-log]: \" --log-level 4");
+}
+
+
 /* 
  * this functions attempts to wipes iptables rules
  * returns 1 if successful, otherwise 0
  */
-unsigned int reset_iptables() 
+unsigned int reset_iptables() 
+{
+	char* commands[][5] =
+	{
+		{"iptables", "-P", "INPUT", "ACCEPT", NULL},
+		{"iptables", "-P", "FORWARD", "ACCEPT", NULL},
+		{"iptables", "-P", "OUTPUT", "ACCEPT", NULL},
+		{"iptables", "-t", "nat", "-F", NULL},
+		{"iptables", "-t", "mangle", "-F", NULL},
+		{"iptables", "-F", NULL},
+		{"iptables", "-X", NULL},
+	};
+	
+	//every step is run even if one fails so as much as possible is cleared
+	unsigned int status = 1;
+	for(unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		status &= run_process(commands[i]);
+	
+	//failed to clear
+	if(status == 0)
+	{
+		write_error("Failed to white iptables rules");
+		return 0;
+	}
+	
+	//successful clear
+	return 1;
+}
+
+
+/*
+ * what identifies one of the iptables rules speakeasy installs,
+ * rules are compared by these fields rather than by their text since
+ * iptables-save prints ex. "-s 1.2.3.4/32 ... --dport 22" for a rule
+ * that was added as "-s 1.2.3.4 ... --dport 22:22"
+ */
+typedef struct IptablesRule
+{
+	char chain[32];
+	char target[32];
+	char source[32];
+	unsigned short portStart;
+	unsigned short portEnd;
+	struct IptablesRule* next;
+} IptablesRule;
+
+
+/*
+ * this struct houses the in memory copy of the filter table: a chained
+ * hash set of the rules and the list of chains, it is loaded once from
+ * iptables-save and kept up to date by iptables_apply so checking if
+ * a rule exists costs no process
+ */
+#define RULE_CACHE_BUCKETS 4096
+#define RULE_CACHE_CHAINS 32
+
+typedef struct
+{
+	IptablesRule* buckets[RULE_CACHE_BUCKETS];
+	char chains[RULE_CACHE_CHAINS][32];
+	unsigned int numChains;
+	unsigned int numRules;
+} RuleCache;
+
+RuleCache _rule_cache = {0};
+
+
+/*
+ * copies the next whitespace separated word of a rule spec into word,
+ * quoted words like the log prefix are kept whole, returns a pointer
+ * past the word or NULL at the end of the spec
+ */
+char* iptables_next_word(char* spec, char* word, size_t wordSize)
+{
+	while(*spec == ' ' || *spec == '\t' || *spec == '\n')
+		spec++;
+	
+	if(*spec == '\0')
+		return NULL;
+	
+	size_t len = 0;
+	unsigned int quoted = 0;
+	
+	for(; *spec != '\0' && (quoted || (*spec != ' ' && *spec != '\t' && *spec != '\n')); spec++)
+	{
+		if(*spec == '"')
+			quoted = !quoted;
+		else if(len + 1 < wordSize)
+			word[len++] = *spec;
+	}
+	
+	word[len] = '\0';
+	return spec;
+}
+
+
+/*
+ * fills rule with the fields of a rule spec in chain,
+ * ex. "-p tcp -s 1.2.3.4 --dport 1:65535 -j LOGGING"
+ */
+void iptables_parse_rule(char* chain, char* spec, IptablesRule* rule)
+{
+	memset(rule, 0, sizeof(IptablesRule));
+	snprintf(rule->chain, sizeof(rule->chain), "%s", chain);
+	
+	char word[64];
+	char value[32];
+	
+	while((spec = iptables_next_word(spec, word, sizeof(word))) != NULL)
+	{
+		unsigned int source = strcmp(word, "-s") == 0 || strcmp(word, "--source") == 0;
+		unsigned int port = strcmp(word, "--dport") == 0 || strcmp(word, "--destination-port") == 0;
+		unsigned int target = strcmp(word, "-j") == 0 || strcmp(word, "--jump") == 0;
+		
+		if(!source && !port && !target)
+			continue;
+		
+		if((spec = iptables_next_word(spec, value, sizeof(value))) == NULL)
+			return;
+		
+		if(source)
+		{
+			//a single address is listed with a /32 prefix
+			char* prefix = strstr(value, "/32");
+			if(prefix != NULL && prefix[3] == '\0')
+				*prefix = '\0';
+			
+			snprintf(rule->source, sizeof(rule->source), "%s", value);
+		}
+		else if(port)
+		{
+			//a single port is the range port:port
+			char* colon = strchr(value, ':');
+			rule->portStart = atoi(value);
+			rule->portEnd = (colon != NULL) ? atoi(colon + 1) : rule->portStart;
+		}
+		else
+			snprintf(rule->target, sizeof(rule->target), "%s", value);
+	}
+}
+
+
+/*
+ * returns the bucket of a rule, FNV-1a over its fields
+ */
+unsigned int rule_cache_bucket(IptablesRule* rule)
+{
+	uint32_t hash = 2166136261u;
+	
+	const char* fields[] = {rule->chain, rule->target, rule->source};
+	for(unsigned int i = 0; i < 3; i++)
+	{
+		for(const char* c = fields[i]; *c != '\0'; c++)
+			hash = (hash ^ (unsigned char) *c) * 16777619u;
+		hash = (hash ^ 0xff) * 16777619u;
+	}
+	
+	hash = (hash ^ rule->portStart) * 16777619u;
+	hash = (hash ^ rule->portEnd) * 16777619u;
+	return hash % RULE_CACHE_BUCKETS;
+}
+
+
+/*
+ * returns 1 if both rules have the same fields, otherwise 0
+ */
+unsigned int rule_cache_match(IptablesRule* a, IptablesRule* b)
+{
+	return a->portStart == b->portStart && a->portEnd == b->portEnd &&
+		   strcmp(a->chain, b->chain) == 0 && strcmp(a->target, b->target) == 0 &&
+		   strcmp(a->source, b->source) == 0;
+}
+
+
+/*
+ * returns the cached rule matching rule or NULL if there is none
+ */
+IptablesRule* rule_cache_find(IptablesRule* rule)
+{
+	IptablesRule* node = _rule_cache.buckets[rule_cache_bucket(rule)];
+	
+	while(node != NULL && !rule_cache_match(node, rule))
+		node = node->next;
+	
+	return node;
+}
+
+
+/*
+ * adds a rule to the cache, returns 1 if successful
+ * or 0 if it was already cached or malloc fails
+ */
+unsigned int rule_cache_insert(IptablesRule* rule)
+{
+	if(rule_cache_find(rule) != NULL)
+		return 0;
+	
+	IptablesRule* node = (IptablesRule*) malloc(sizeof(IptablesRule));
+	if(node == NULL)
+		return 0;
+	
+	*node = *rule;
+	
+	unsigned int bucket = rule_cache_bucket(rule);
+	node->next = _rule_cache.buckets[bucket];
+	_rule_cache.buckets[bucket] = node;
+	_rule_cache.numRules++;
+	return 1;
+}
+
+
+/*
+ * removes a rule from the cache, returns 1 if
+ * it was cached, otherwise 0
+ */
+unsigned int rule_cache_remove(IptablesRule* rule)
+{
+	IptablesRule** link = &_rule_cache.buckets[rule_cache_bucket(rule)];
+	
+	while(*link != NULL)
+	{
+		if(rule_cache_match(*link, rule))
+		{
+			IptablesRule* node = *link;
+			*link = node->next;
+			free(node);
+			_rule_cache.numRules--;
+			return 1;
+		}
+		link = &(*link)->next;
+	}
+	return 0;
+}
+
+
+/*
+ * empties the rule cache
+ */
+void rule_cache_clear()
+{
+	for(unsigned int i = 0; i < RULE_CACHE_BUCKETS; i++)
+	{
+		while(_rule_cache.buckets[i] != NULL)
+		{
+			IptablesRule* node = _rule_cache.buckets[i];
+			_rule_cache.buckets[i] = node->next;
+			free(node);
+		}
+	}
+	
+	_rule_cache.numChains = 0;
+	_rule_cache.numRules = 0;
+}
+
+
+/*
+ * returns 1 if the chain exists according to the cache, otherwise 0
+ */
+unsigned int iptables_chain_exists(char* chain)
+{
+	for(unsigned int i = 0; i < _rule_cache.numChains; i++)
+	{
+		if(strcmp(_rule_cache.chains[i], chain) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * records a chain in the cache, returns 1 if successful otherwise 0
+ */
+unsigned int rule_cache_add_chain(char* chain)
+{
+	if(iptables_chain_exists(chain))
+		return 1;
+	
+	if(_rule_cache.numChains == RULE_CACHE_CHAINS)
+		return 0;
+	
+	snprintf(_rule_cache.chains[_rule_cache.numChains++], sizeof(_rule_cache.chains[0]), "%s", chain);
+	return 1;
+}
+
+
+/*
+ * (re)loads the rule cache from the filter table with a single
+ * iptables-save, returns 1 if successful otherwise 0
+ */
+unsigned int iptables_load_rule_cache()
+{
+	rule_cache_clear();
+	
+	char* argv[] = {"iptables-save", "-t", "filter", NULL};
+	ProcessPipe save;
+	if(open_process_pipe(&save, argv, 'r') == 0)
+		return 0;
+	
+	FILE* fptr = save.stream;
+	
+	//chains are listed as ":NAME POLICY [packets:bytes]" and rules as "-A CHAIN spec"
+	char line[1024];
+	char chain[32];
+	
+	while(fgets(line, sizeof(line), fptr) != NULL)
+	{
+		if(line[0] == ':')
+		{
+			iptables_next_word(line + 1, chain, sizeof(chain));
+			rule_cache_add_chain(chain);
+		}
+		else if(strncmp(line, "-A ", 3) == 0)
+		{
+			char* spec = iptables_next_word(line + 3, chain, sizeof(chain));
+			if(spec == NULL)
+				continue;
+			
+			IptablesRule rule;
+			iptables_parse_rule(chain, spec, &rule);
+			rule_cache_insert(&rule);
+		}
+	}
+	
+	if(close_process_pipe(&save) == 0)
+	{
+		write_error("Failed to read iptables rules with iptables-save");
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * this function checks to see if a given iptables
+ * rule already exists using the rule cache, returns 1
+ * if it exists or 0 if the rule doesn't exist
+ */
+unsigned int iptables_check_rule(char* chain, char* spec)
+{
+	IptablesRule rule;
+	iptables_parse_rule(chain, spec, &rule);
+	return rule_cache_find(&rule) != NULL;
+}
+
+
+/*
+ * names of the ipsets holding whitelisted hosts, single addresses and
+ * ranges need different set types so both are members of one list:set
+ * which is what the ACCEPT rule matches against
+ */
+#define WHITELIST_SET "speakeasy-allow"
+#define WHITELIST_HOST_SET "speakeasy-allow-ip"
+#define WHITELIST_NET_SET "speakeasy-allow-net"
+#define WHITELIST_SET_SIZE 1048576
+
+
+/*
+ * a single firewall change, for iptables chain and spec are kept apart
+ * so an add and a delete of the same rule can be matched up ex. chain
+ * "INPUT" and spec "-p tcp --dport 22 -j DROP", for ipset changes
+ * chain is the set and spec is the entry, attempts counts how often
+ * the change was retried after failing
+ */
+typedef struct
+{
+	char action;
+	unsigned int ipset;
+	unsigned int attempts;
+	char chain[24];
+	char spec[192];
+} FirewallOp;
+
+
+/*
+ * this struct collects the firewall changes of one processing pass
+ * so they can be applied together with iptables-restore and ipset restore
+ */
+#define FIREWALL_BATCH_SIZE 1024
+
+typedef struct
+{
+	unsigned int active;
+	unsigned int count;
+	FirewallOp ops[FIREWALL_BATCH_SIZE];
+} FirewallBatch;
+
+FirewallBatch _firewall_batch = {0};
+
+
+/*
+ * runs a single firewall change with its own process, the spec is
+ * split into arguments so it never passes through a shell
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int iptables_run_op(FirewallOp* op)
+{
+	char* argv[PROCESS_MAX_ARGS];
+	char action[3] = {'-', op->action, '\0'};
+	char spec[sizeof(op->spec)];
+	snprintf(spec, sizeof(spec), "%s", op->spec);
+	
+	//-exist makes adding a present entry or deleting a missing one succeed
+	if(op->ipset)
+	{
+		char* ipsetArgv[] = {"ipset", (op->action == 'D') ? "del" : "add", op->chain, spec, "-exist", NULL};
+		return run_process(ipsetArgv);
+	}
+	
+	argv[0] = "iptables";
+	argv[1] = action;
+	argv[2] = op->chain;
+	if(split_arguments(spec, argv + 3, PROCESS_MAX_ARGS - 3) == -1)
+		return 0;
+	
+	return run_process(argv);
+}
+
+
+/*
+ * starts collecting firewall changes instead of running them,
+ * they are applied by iptables_batch_commit
+ */
+void iptables_batch_begin()
+{
+	_firewall_batch.active = 1;
+	_firewall_batch.count = 0;
+}
+
+
+/*
+ * pipes either the ipset or the iptables changes of a batch into
+ * one restore process, returns 1 if the restore succeeded or there
+ * was nothing to restore, otherwise 0
+ */
+unsigned int iptables_batch_restore(FirewallBatch* batch, unsigned int ipset)
+{
+	unsigned int pending = 0;
+	for(unsigned int i = 0; i < batch->count; i++)
+		pending += batch->ops[i].ipset == ipset;
+	
+	if(pending == 0)
+		return 1;
+	
+	char* ipsetArgv[] = {"ipset", "restore", "-exist", NULL};
+	char* iptablesArgv[] = {"iptables-restore", "--noflush", NULL};
+	
+	ProcessPipe process;
+	if(open_process_pipe(&process, ipset ? ipsetArgv : iptablesArgv, 'w') == 0)
+		return 0;
+	
+	FILE* restore = process.stream;
+	
+	if(!ipset)
+		fprintf(restore, "*filter\n");
+	
+	for(unsigned int i = 0; i < batch->count; i++)
+	{
+		FirewallOp* op = &batch->ops[i];
+		
+		if(op->ipset != ipset)
+			continue;
+		
+		if(ipset)
+			fprintf(restore, "%s %s %s\n", (op->action == 'D') ? "del" : "add", op->chain, op->spec);
+		else
+			fprintf(restore, "-%c %s %s\n", op->action, op->chain, op->spec);
+	}
+	
+	if(!ipset)
+		fprintf(restore, "COMMIT\n");
+	
+	return close_process_pipe(&process);
+}
+
+
+/*
+ * undoes what iptables_apply recorded in the rule cache
+ * for a rule change that failed to apply
+ */
+void rule_cache_revert(FirewallOp* op)
+{
+	if(op->ipset)
+		return;
+	
+	IptablesRule rule;
+	iptables_parse_rule(op->chain, op->spec, &rule);
+	
+	if(op->action == 'D')
+		rule_cache_insert(&rule);
+	else
+		rule_cache_remove(&rule);
+}
+
+
+/*
+ * applies every change of a batch with one ipset restore and one
+ * iptables-restore --noflush, which applies the rules atomically under
+ * one xtables lock, if a restore is refused the changes are run one
+ * by one so a single bad rule doesn't take the others down with it,
+ * every change that still fails is handed to failed
+ * returns 1 if everything was applied, otherwise 0
+ *
+ * side effect: only runs commands, so it is safe off the main thread
+ */
+unsigned int iptables_batch_apply(FirewallBatch* batch, void (*failed)(FirewallOp*))
+{
+	uint64_t startNs = monotonic_ns();
+	metric_add(METRIC_FIREWALL_OPS_ISSUED, batch->count);
+	
+	//set entries go first, then the rules
+	unsigned int status = 1;
+	unsigned int order[] = {1, 0};
+	
+	for(unsigned int j = 0; j < 2; j++)
+	{
+		unsigned int ipset = order[j];
+		if(iptables_batch_restore(batch, ipset))
+			continue;
+		
+		for(unsigned int i = 0; i < batch->count; i++)
+		{
+			if(batch->ops[i].ipset == ipset && iptables_run_op(&batch->ops[i]) == 0)
+			{
+				metric_add(METRIC_FIREWALL_OPS_FAILED, 1);
+				failed(&batch->ops[i]);
+				status = 0;
+			}
+		}
+	}
+	
+	metric_observe(METRIC_FIREWALL_SECONDS, startNs);
+	return status;
+}
+
+
+/*
+ * logs a change that failed to apply on the main thread and
+ * takes it back out of the rule cache
+ */
+void iptables_op_failed(FirewallOp* op)
+{
+	write_error_two("Failed to apply firewall change to: ", op->chain);
+	rule_cache_revert(op);
+}
+
+
+/*
+ * this struct houses the executor, a thread that runs the iptables
+ * and ipset commands of every batch so the main loop never waits on
+ * the xtables lock:
+ * 	-batches are copied into a ring of slots, head is the oldest
+ * 	 and they are applied in the order they were committed
+ * 	-changes that failed are collected in failed until the main
+ * 	 thread picks them up with poll_firewall_executor, lost counts
+ * 	 the ones that didn't fit
+ * 	-pending is the number of batches not applied yet
+ */
+#define EXECUTOR_QUEUE_SIZE 8
+#define EXECUTOR_FAILED_SIZE 256
+
+//how often a failed change is tried again and how soon the
+//main loop wakes up to hand the failure back to it
+#define FIREWALL_RETRY_LIMIT 3
+#define EXECUTOR_POLL_MS 100
+
+typedef struct
+{
+	unsigned int running;
+	unsigned int stopping;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	FirewallBatch* slots;
+	unsigned int head;
+	unsigned int pending;
+	FirewallOp failed[EXECUTOR_FAILED_SIZE];
+	unsigned int numFailed;
+	unsigned int lost;
+} FirewallExecutor;
+
+FirewallExecutor _firewall_executor = {.lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+									   .space = PTHREAD_COND_INITIALIZER};
+
+
+/*
+ * hands a change the executor failed to apply back to the main thread
+ */
+void executor_op_failed(FirewallOp* op)
+{
+	FirewallExecutor* executor = &_firewall_executor;
+	
+	pthread_mutex_lock(&executor->lock);
+	if(executor->numFailed < EXECUTOR_FAILED_SIZE)
+		executor->failed[executor->numFailed++] = *op;
+	else
+		executor->lost++;
+	pthread_mutex_unlock(&executor->lock);
+}
+
+
+/*
+ * the executor thread, applies batches in order until it
+ * is stopped and the queue is empty
+ */
+void* firewall_executor(void* arg)
+{
+	FirewallExecutor* executor = (FirewallExecutor*) arg;
+	
+	pthread_mutex_lock(&executor->lock);
+	while(1)
+	{
+		while(executor->pending == 0 && !executor->stopping)
+			pthread_cond_wait(&executor->work, &executor->lock);
+		
+		if(executor->pending == 0)
+			break;
+		
+		//the slot stays taken while it is applied so the main thread can't reuse it
+		FirewallBatch* batch = &executor->slots[executor->head];
+		pthread_mutex_unlock(&executor->lock);
+		
+		iptables_batch_apply(batch, executor_op_failed);
+		
+		pthread_mutex_lock(&executor->lock);
+		executor->head = (executor->head + 1) % EXECUTOR_QUEUE_SIZE;
+		executor->pending--;
+		pthread_cond_signal(&executor->space);
+	}
+	pthread_mutex_unlock(&executor->lock);
+	
+	return NULL;
+}
+
+
+/*
+ * starts the executor thread, from then on committed batches are
+ * applied in the background, returns 1 if successful otherwise 0
+ */
+unsigned int start_firewall_executor()
+{
+	FirewallExecutor* executor = &_firewall_executor;
+	
+	executor->slots = (FirewallBatch*) malloc(sizeof(FirewallBatch) * EXECUTOR_QUEUE_SIZE);
+	if(executor->slots == NULL)
+		return 0;
+	
+	executor->head = 0;
+	executor->pending = 0;
+	executor->stopping = 0;
+	
+	if(start_thread(&executor->thread, firewall_executor, executor) == 0)
+	{
+		free(executor->slots);
+		executor->slots = NULL;
+		return 0;
+	}
+	
+	executor->running = 1;
+	return 1;
+}
+
+
+/*
+ * lets the executor finish the batches it was given and stops it
+ */
+void stop_firewall_executor()
+{
+	FirewallExecutor* executor = &_firewall_executor;
+	
+	if(executor->running == 0)
+		return;
+	
+	pthread_mutex_lock(&executor->lock);
+	executor->stopping = 1;
+	pthread_cond_signal(&executor->work);
+	pthread_mutex_unlock(&executor->lock);
+	
+	pthread_join(executor->thread, NULL);
+	free(executor->slots);
+	executor->slots = NULL;
+	executor->running = 0;
+}
+
+
+/*
+ * copies a batch into the executor's queue, waiting for a free slot
+ * if the executor is that far behind
+ */
+void executor_submit(FirewallBatch* batch)
+{
+	FirewallExecutor* executor = &_firewall_executor;
+	
+	pthread_mutex_lock(&executor->lock);
+	while(executor->pending == EXECUTOR_QUEUE_SIZE)
+		pthread_cond_wait(&executor->space, &executor->lock);
+	
+	FirewallBatch* slot = &executor->slots[(executor->head + executor->pending) % EXECUTOR_QUEUE_SIZE];
+	slot->count = batch->count;
+	memcpy(slot->ops, batch->ops, sizeof(FirewallOp) * batch->count);
+	
+	executor->pending++;
+	pthread_cond_signal(&executor->work);
+	pthread_mutex_unlock(&executor->lock);
+}
+
+
+/*
+ * hands every change the executor failed to apply since the last
+ * call to handler on the main thread, returns the number of changes
+ */
+unsigned int poll_firewall_executor(void (*handler)(FirewallOp*))
+{
+	FirewallExecutor* executor = &_firewall_executor;
+	
+	if(executor->running == 0)
+		return 0;
+	
+	FirewallOp failed[EXECUTOR_FAILED_SIZE];
+	
+	pthread_mutex_lock(&executor->lock);
+	unsigned int numFailed = executor->numFailed;
+	unsigned int lost = executor->lost;
+	memcpy(failed, executor->failed, sizeof(FirewallOp) * numFailed);
+	executor->numFailed = 0;
+	executor->lost = 0;
+	pthread_mutex_unlock(&executor->lock);
+	
+	if(lost > 0)
+		write_error("Too many firewall changes failed at once, some of them won't be retried");
+	
+	for(unsigned int i = 0; i < numFailed; i++)
+		handler(&failed[i]);
+	
+	return numFailed;
+}
+
+
+/*
+ * returns 1 while the executor has batches to apply or failures
+ * that weren't picked up yet, otherwise 0
+ */
+unsigned int firewall_executor_busy()
 {
-	int result;
-    result = system("iptables -P INPUT ACCEPT");
-    result = system("iptables -P FORWARD ACCEPT");
-    result = system("iptables -P OUTPUT ACCEPT");
-    result = system("iptables -t nat -F");
-    result = system("iptables -t mangle -F");
-    result = system("iptables -F");
-    result = system("iptables -X");
+	FirewallExecutor* executor = &_firewall_executor;
 	
-	//failed to clear
-	if(result == -1 || WEXITSTATUS(result) != 0)
-	{
-		write_log("Failed to white iptables rules");
+	if(executor->running == 0)
 		return 0;
-	}
 	
-	//successful clear
-	return 1;
+	pthread_mutex_lock(&executor->lock);
+	unsigned int busy = executor->pending > 0 || executor->numFailed > 0 || executor->lost > 0;
+	pthread_mutex_unlock(&executor->lock);
+	return busy;
 }
 
 
 /*
- * this function checks to see if a given iptables
- * rule already exists, returns 1 if it exists
- * or 0 if the cmd fails or the rule doesn't exist
+ * returns how many batches are waiting for the executor
  */
-unsigned int iptables_check_rule(char* rule, char* port)
+unsigned int firewall_executor_queued()
 {
-	FILE* fptr = popen("iptables -L -n", "r");
+	FirewallExecutor* executor = &_firewall_executor;
 	
-	if(fptr == NULL)
+	if(executor->running == 0)
 		return 0;
 	
-	//search and close file
-	char line[512];
+	pthread_mutex_lock(&executor->lock);
+	unsigned int pending = executor->pending;
+	pthread_mutex_unlock(&executor->lock);
+	return pending;
+}
+
+
+/*
+ * applies every queued change, once the executor is running the
+ * batch is handed to it and the changes are reported back through
+ * poll_firewall_executor, until then they are applied right away
+ * returns 1 if everything was applied or handed off, otherwise 0
+ */
+unsigned int iptables_batch_commit()
+{
+	FirewallBatch* batch = &_firewall_batch;
+	batch->active = 0;
+	
+	if(batch->count == 0)
+		return 1;
 	
-	while(fgets(line, sizeof(line), fptr) != NULL)
+	unsigned int status = 1;
+	if(_firewall_executor.running)
+		executor_submit(batch);
+	else
+		status = iptables_batch_apply(batch, iptables_op_failed);
+	
+	batch->count = 0;
+	return status;
+}
+
+
+/*
+ * queues a firewall change in the open batch, a delete cancels a pending
+ * add of the same rule or entry and vice versa so hosts that come and go
+ * within one pass cost nothing, returns 1 if the change was queued or
+ * cancelled out and 0 if no batch is open
+ */
+unsigned int iptables_batch_queue(FirewallOp* op)
+{
+	FirewallBatch* batch = &_firewall_batch;
+	
+	if(batch->active == 0)
+		return 0;
+	
+	//look for the opposite change of the same rule, newest first
+	for(int i = batch->count - 1; i >= 0; i--)
 	{
-		if(strstr(line, rule) != NULL && strstr(line, port) != NULL)
+		FirewallOp* pending = &batch->ops[i];
+		unsigned int opposite = (op->action == 'D') != (pending->action == 'D');
+		
+		if(opposite && pending->ipset == op->ipset && strcmp(pending->chain, op->chain) == 0 &&
+		   strcmp(pending->spec, op->spec) == 0)
 		{
-			pclose(fptr);
+			memmove(pending, pending + 1, sizeof(FirewallOp) * (batch->count - i - 1));
+			batch->count--;
 			return 1;
 		}
 	}
-	pclose(fptr);
+	
+	//a full batch is applied early and a new one started
+	if(batch->count == FIREWALL_BATCH_SIZE)
+	{
+		iptables_batch_commit();
+		iptables_batch_begin();
+	}
+	
+	batch->ops[batch->count] = *op;
+	batch->count++;
+	return 1;
+}
+
+
+/*
+ * applies a rule change, ex. iptables_apply('D', "INPUT", "-p tcp --dport 22 -j DROP"),
+ * while a batch is open it is only queued, otherwise it runs right away,
+ * adding a rule the cache already has or deleting one it doesn't have
+ * is skipped, returns 1 if successful, otherwise 0
+ */
+unsigned int iptables_apply(char action, char* chain, char* spec)
+{
+	FirewallOp op = {.action = action, .ipset = 0};
+	snprintf(op.chain, sizeof(op.chain), "%s", chain);
+	snprintf(op.spec, sizeof(op.spec), "%s", spec);
+	
+	//the cache is updated right away so later checks in the same pass see this change
+	IptablesRule rule;
+	iptables_parse_rule(chain, spec, &rule);
+	
+	if(action == 'D')
+	{
+		if(rule_cache_remove(&rule) == 0)
+			return 1;
+	}
+	else if(rule_cache_find(&rule) != NULL)
+		return 1;
+	else
+		rule_cache_insert(&rule);
+	
+	if(iptables_batch_queue(&op))
+		return 1;
+	
+	if(iptables_run_op(&op))
+		return 1;
+	
+	rule_cache_revert(&op);
 	return 0;
 }
 
 
+/*
+ * adds ('A') or deletes ('D') an entry of an ipset, batched
+ * like iptables_apply, returns 1 if successful, otherwise 0
+ */
+unsigned int ipset_apply(char action, char* set, char* entry)
+{
+	FirewallOp op = {.action = action, .ipset = 1};
+	snprintf(op.chain, sizeof(op.chain), "%s", set);
+	snprintf(op.spec, sizeof(op.spec), "%s", entry);
+	
+	if(iptables_batch_queue(&op))
+		return 1;
+	
+	return iptables_run_op(&op);
+}
+
+
+/*
+ * (re)creates the empty whitelist sets, this has to happen
+ * after reset_iptables since sets can't be destroyed while
+ * rules still reference them, returns 1 if successful, otherwise 0
+ */
+unsigned int ipset_create_whitelist()
+{
+	//left over sets may have been created with other parameters,
+	//they are usually not there so failing to destroy them is fine
+	char* sets[] = {WHITELIST_SET, WHITELIST_HOST_SET, WHITELIST_NET_SET};
+	for(unsigned int i = 0; i < 3; i++)
+	{
+		char* destroyArgv[] = {"ipset", "destroy", sets[i], NULL};
+		run_process(destroyArgv);
+	}
+	
+	char* restoreArgv[] = {"ipset", "restore", "-exist", NULL};
+	ProcessPipe process;
+	if(open_process_pipe(&process, restoreArgv, 'w') == 0)
+		return 0;
+	
+	FILE* restore = process.stream;
+	
+	fprintf(restore, "create %s hash:ip maxelem %d\n", WHITELIST_HOST_SET, WHITELIST_SET_SIZE);
+	fprintf(restore, "create %s hash:net maxelem %d\n", WHITELIST_NET_SET, WHITELIST_SET_SIZE);
+	fprintf(restore, "create %s list:set\n", WHITELIST_SET);
+	fprintf(restore, "add %s %s\n", WHITELIST_SET, WHITELIST_HOST_SET);
+	fprintf(restore, "add %s %s\n", WHITELIST_SET, WHITELIST_NET_SET);
+	
+	if(close_process_pipe(&process) == 0)
+	{
+		write_error("Failed to create whitelist ipsets");
+		return 0;
+	}
+	return 1;
+}
+
+
 /*
  * this function drops or rejects a port using iptables
  * depending on firewallResponse's value
@@ -67,21 +977,37 @@ unsigned int iptables_block_port(char* port, char* firewallResponse)
 	if(strlen(port) > 5 || strcmp(port, "") == 0)
 		return 0;
 	
+	char spec[64];
+	sprintf(spec, "-p tcp --dport %s -j %s", port, firewallResponse);
+	
 	//check if the rule already exists
-	if(iptables_check_rule(firewallResponse, port))
+	if(iptables_check_rule("INPUT", spec))
 		return 0;
 	
-	//max size of command is 66 bytes
-	char cmd[66];
-	sprintf(cmd, "iptables -A INPUT -p tcp --dport %s -j %s > /dev/null 2>&1",
-			port, firewallResponse);
+	if(iptables_apply('A', "INPUT", spec) == 0)
+	{
+		write_error("Failed to run iptables block command");
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * this function removes the rule iptables_block_port added
+ * for a port, returns a 1 if successful, otherwise 0
+ */
+unsigned int iptables_unblock_port(char* port, char* firewallResponse)
+{
+	if(port == NULL || strlen(port) > 5 || strcmp(port, "") == 0)
+		return 0;
 	
-	//run command
-	int result = system(cmd);
+	char spec[64];
+	sprintf(spec, "-p tcp --dport %s -j %s", port, firewallResponse);
 	
-	if(result == -1 || WEXITSTATUS(result) != 0)
+	if(iptables_apply('D', "INPUT", spec) == 0)
 	{
-		write_log("Failed to run iptables block command");
+		write_error("Failed to run iptables unblock command");
 		return 0;
 	}
 	return 1;
@@ -89,75 +1015,48 @@ unsigned int iptables_block_port(char* port, char* firewallResponse)
 
 
 /*
- * this function whitelists a host using iptables
- * returns a 1 if successful, otherwise 0
+ * this function whitelists a host or an address range in cidr
+ * notation by adding it to the whitelist ipset, returns a 1 if
+ * successful, otherwise 0
  */
 unsigned int iptables_whitelist_host(char* host)
 {
 	if(host == NULL)
 		return 0;
 	
-	//max size IP is 15 bytes long
-	if(strlen(host) > 15)
-		return 0;
-	
-	//check if the rule already exists
-	if(iptables_check_rule("ACCEPT", host))
+	//max size IP is 15 bytes long, 18 with a prefix length
+	if(strlen(host) > 18 || strlen(host) == 0)
 		return 0;
 	
-	//max size of command is 66 bytes
-	char cmd[66];
-	sprintf(cmd, "iptables -I INPUT 2 -s %s -j ACCEPT > /dev/null 2>&1", host);
+	char* set = (strchr(host, '/') != NULL) ? WHITELIST_NET_SET : WHITELIST_HOST_SET;
 	
-	//run command
-	int result = system(cmd);
-	
-	if(result == -1 || WEXITSTATUS(result) != 0)
+	if(ipset_apply('A', set, host) == 0)
 	{
-		//try again without inserting at position 2
-		//this happens if no ports were blacklisted 
-		char cmdRetry[64];
-		sprintf(cmdRetry, "iptables -I INPUT -s %s -j ACCEPT > /dev/null 2>&1", host);
-		result = system(cmdRetry);
-		
-		//check again
-		if(result == -1 || WEXITSTATUS(result) != 0)
-		{
-			write_log("Failed to run iptables whitelist command");
-			return 0;
-		}
+		write_error("Failed to run ipset whitelist command");
+		return 0;
 	}
 	return 1;
 }
 
 
 /* 
- * this function removes a host from the whitelist
- * using iptables returns a 1 if successful, otherwise 0
+ * this function removes a host or address range from the
+ * whitelist ipset returns a 1 if successful, otherwise 0
  */
 unsigned int iptables_remove_host(char* host)
 {
 	if(host == NULL)
 		return 0;
 	
-	//max size IP is 15 bytes long
-	if(strlen(host) > 15)
-		return 0;
-	
-	//check if the rule already exists
-	if(!iptables_check_rule("ACCEPT", host))
+	//max size IP is 15 bytes long, 18 with a prefix length
+	if(strlen(host) > 18 || strlen(host) == 0)
 		return 0;
 	
-	//max size of command is 66 bytes
-	char cmd[66];
-	sprintf(cmd, "iptables -D INPUT -s %s -j ACCEPT > /dev/null 2>&1", host);
-	
-	//run command
-	int result = system(cmd);
+	char* set = (strchr(host, '/') != NULL) ? WHITELIST_NET_SET : WHITELIST_HOST_SET;
 	
-	if(result == -1 || WEXITSTATUS(result) != 0)
+	if(ipset_apply('D', set, host) == 0)
 	{
-		write_log("Failed to run iptables remove host from whitelist command");
+		write_error("Failed to run ipset remove host from whitelist command");
 		return 0;
 	}
 	return 1;
@@ -180,51 +1079,46 @@ void iptables_log_ports(char* startPort, char* endPort, char* host)
 	if(strlen(startPort) > 5 || strlen(endPort) > 5 || strlen(host) > 15)
 		return;
 	
-	//track whether commands succeeded or not
-	int cmdResult;
+	//the log backend doesn't rely on firewall logging
+	if(_firewall_log_target[0] == '\0')
+		return;
 	
-	//make logging chain if it doesn't exist
-	if(!iptables_check_rule("LOGGING", "tcp"))
-		cmdResult = system("iptables -N LOGGING > /dev/null 2>&1");
+	//make logging chain if it doesn't exist, this can't wait for
+	//the batch since the rules below jump to it
+	if(!iptables_chain_exists("LOGGING"))
+	{
+		char* argv[] = {"iptables", "-N", "LOGGING", NULL};
+		if(run_process(argv))
+			rule_cache_add_chain("LOGGING");
+	}
 	
 	//if no host specified, generally log the port/ports
+	char spec1[64];
+	char spec2[192];
+	
 	if(strlen(host) == 0)
 	{
-		//run both commands excluding host
-		char cmd1[74];
-		sprintf(cmd1, "iptables -I INPUT -p tcp --dport %s:%s -j LOGGING > /dev/null 2>&1",
-				startPort, endPort);
-		
-		char cmd2[114];
-		sprintf(cmd2, "iptables -I LOGGING -p tcp --dport %s:%s -j LOG --log-prefix \"[Speakeasy-log]: \" --log-level 4 > /dev/null 2>&1",
-				startPort, endPort);
-		
-		cmdResult = system(cmd1);
-		cmdResult = system(cmd2);
+		sprintf(spec1, "-p tcp --dport %s:%s -j LOGGING", startPort, endPort);
+		sprintf(spec2, "-p tcp --dport %s:%s -j %s", startPort, endPort, _firewall_log_target);
 	}
 	else
 	{
-		//run both commands including host
-		char cmd1[92];
-		sprintf(cmd1, "iptables -I INPUT -p tcp -s %s --dport %s:%s -j LOGGING > /dev/null 2>&1",
-				host, startPort, endPort);
-		
-		char cmd2[130];
-		sprintf(cmd2, "iptables -I LOGGING -p tcp -s %s --dport %s:%s -j LOG --log-prefix \"[Speakeasy-log]: \" --log-level 4 > /dev/null 2>&1",
-				host, startPort, endPort);
-
-		cmdResult = system(cmd1);
-		cmdResult = system(cmd2);
+		sprintf(spec1, "-p tcp -s %s --dport %s:%s -j LOGGING", host, startPort, endPort);
+		sprintf(spec2, "-p tcp -s %s --dport %s:%s -j %s", host, startPort, endPort, _firewall_log_target);
 	}
 	
-	if(cmdResult == -1 || WEXITSTATUS(cmdResult) != 0)
-		write_log("Failed to run iptables logging command");
+	unsigned int status = iptables_apply('I', "INPUT", spec1);
+	status &= iptables_apply('I', "LOGGING", spec2);
+	
+	if(status == 0)
+		write_error("Failed to run iptables logging command");
 }
 
 
 /*
  * this function stops logging a host by deleting them from 
- * the logging rules
+ * the logging rules, an empty host stops the general logging
+ * of the ports the same way iptables_log_ports started it
  */
 void iptables_stop_logging_host(char* startPort, char* endPort, char* host)
 {
@@ -235,58 +1129,284 @@ void iptables_stop_logging_host(char* startPort, char* endPort, char* host)
 	if(strlen(startPort) > 5 || strlen(endPort) > 5 || strlen(host) > 15)
 		return;
 	
-	char cmd1[92];
-	sprintf(cmd1, "iptables -D INPUT -p tcp -s %s --dport %s:%s -j LOGGING > /dev/null 2>&1",
-			host, startPort, endPort);
+	if(_firewall_log_target[0] == '\0')
+		return;
+	
+	char spec1[64];
+	char spec2[192];
 	
-	char cmd2[130];
-	sprintf(cmd2, "iptables -D LOGGING -p tcp -s %s --dport %s:%s -j LOG --log-prefix \"[Speakeasy-log]: \" --log-level 4 > /dev/null 2>&1",
-			host, startPort, endPort);
-
-	int cmdResult;
-	cmdResult = system(cmd1);
-	cmdResult = system(cmd2);
+	if(strlen(host) == 0)
+	{
+		sprintf(spec1, "-p tcp --dport %s:%s -j LOGGING", startPort, endPort);
+		sprintf(spec2, "-p tcp --dport %s:%s -j %s", startPort, endPort, _firewall_log_target);
+	}
+	else
+	{
+		sprintf(spec1, "-p tcp -s %s --dport %s:%s -j LOGGING", host, startPort, endPort);
+		sprintf(spec2, "-p tcp -s %s --dport %s:%s -j %s", host, startPort, endPort, _firewall_log_target);
+	}
 	
-	if(cmdResult == -1 || WEXITSTATUS(cmdResult) != 0)
-		write_log("Failed to run iptables stop logging command");
+	unsigned int status = iptables_apply('D', "INPUT", spec1);
+	status &= iptables_apply('D', "LOGGING", spec2);
+	
+	if(status == 0)
+		write_error("Failed to run iptables stop logging command");
 }
 
 
 /*
- * sets up basic iptables rules using a config struct
- * and a file pointer to whitelist.txt
- * i.e. whitelisting hosts and blacklisting ports
+ * sets up the iptables side of the firewall: the reset ruleset,
+ * first port logging, the whitelist ipsets with the rule accepting
+ * them and the blacklisted ports
  */
-void setup_firewall(Config* cfg)
+void setup_iptables(Config* cfg)
 {	
-	if(cfg == NULL)
-		return;
-	
-	//clear iptables rules
+	//clear iptables rules, then take one snapshot of what is left
 	reset_iptables();
+	iptables_load_rule_cache();
 	
-	//start logging the first port in port knocking sequence
-	if(strlen(cfg->portsToKnock[0]) != 0)
-		iptables_log_ports(cfg->portsToKnock[0], cfg->portsToKnock[0], "");
+	//everything below goes out in one iptables-restore
+	iptables_batch_begin();
 	
-	//whitelist hosts then free
-	char** hostArry = lines_of_file_to_str_array(cfg->whitelistFile);
-	for(unsigned int i = 0; hostArry[i] != NULL; i++)
+	//start logging the first port in port knocking sequence
+	for(unsigned int i = 0; i < cfg->knockProgram->numEntryPorts; i++)
 	{
-		sanitize_dyn(hostArry[i]);
-		iptables_whitelist_host(hostArry[i]);
+		char port[6];
+		snprintf(port, sizeof(port), "%u", cfg->knockProgram->entryPorts[i]);
+		iptables_log_ports(port, port, "");
 	}
 	
-	free_all_double_char((char**[]) {hostArry}, 1);
+	//one rule accepts every whitelisted host, placed behind the first
+	//port logging rule so whitelisted hosts can still knock
+	ipset_create_whitelist();
+	iptables_apply('A', "INPUT", "-m set --match-set " WHITELIST_SET " src -j ACCEPT");
 	
 	//blacklist ports
 	for(unsigned int i = 0; cfg->blacklistPorts[i] != NULL; i++)
 	{
 		//check for EOL
 		if(cfg->blacklistPorts[i][0] == '\n')
-			return;
+			break;
 		
 		//block ports specified in config
 		iptables_block_port(cfg->blacklistPorts[i], cfg->firewallResponse);
 	}
-}
\ No newline at end of file
+	
+	if(iptables_batch_commit() == 0)
+		write_error("Some firewall rules failed to apply during setup");
+}
+
+
+/*
+ * returns 1 if port is one of the blacklisted ports of a config, otherwise 0
+ */
+unsigned int config_blocks_port(Config* cfg, char* port)
+{
+	for(unsigned int i = 0; cfg->blacklistPorts[i] != NULL; i++)
+	{
+		if(cfg->blacklistPorts[i][0] == '\n')
+			break;
+		
+		if(atoi(cfg->blacklistPorts[i]) == atoi(port))
+			return 1;
+	}
+	
+	return 0;
+}
+
+
+/*
+ * returns 1 if port is the first port of a knock sequence of a config, otherwise 0
+ */
+unsigned int config_logs_port(Config* cfg, uint16_t port)
+{
+	for(unsigned int i = 0; i < cfg->knockProgram->numEntryPorts; i++)
+	{
+		if(cfg->knockProgram->entryPorts[i] == port)
+			return 1;
+	}
+	
+	return 0;
+}
+
+
+/*
+ * queues the iptables changes that take the rules set up for one config
+ * to those of another: logging of first ports that were added or dropped
+ * and blocking of blacklisted ports that were added, dropped or respond
+ * differently, new rules are queued before old ones go so a port that
+ * stays blocked never is open in between, everything else is left alone
+ */
+void iptables_reload_rules(Config* old, Config* cfg)
+{
+	unsigned int sameResponse = strcmp(old->firewallResponse, cfg->firewallResponse) == 0;
+	char port[6];
+	
+	for(unsigned int i = 0; i < cfg->knockProgram->numEntryPorts; i++)
+	{
+		if(config_logs_port(old, cfg->knockProgram->entryPorts[i]) == 0)
+		{
+			snprintf(port, sizeof(port), "%u", cfg->knockProgram->entryPorts[i]);
+			iptables_log_ports(port, port, "");
+		}
+	}
+	
+	for(unsigned int i = 0; cfg->blacklistPorts[i] != NULL && cfg->blacklistPorts[i][0] != '\n'; i++)
+	{
+		if(sameResponse == 0 || config_blocks_port(old, cfg->blacklistPorts[i]) == 0)
+			iptables_block_port(cfg->blacklistPorts[i], cfg->firewallResponse);
+	}
+	
+	for(unsigned int i = 0; i < old->knockProgram->numEntryPorts; i++)
+	{
+		if(config_logs_port(cfg, old->knockProgram->entryPorts[i]) == 0)
+		{
+			snprintf(port, sizeof(port), "%u", old->knockProgram->entryPorts[i]);
+			iptables_stop_logging_host(port, port, "");
+		}
+	}
+	
+	for(unsigned int i = 0; old->blacklistPorts[i] != NULL && old->blacklistPorts[i][0] != '\n'; i++)
+	{
+		if(sameResponse == 0 || config_blocks_port(cfg, old->blacklistPorts[i]) == 0)
+			iptables_unblock_port(old->blacklistPorts[i], old->firewallResponse);
+	}
+}
+
+
+/*
+ * the firewall backend picked in config.txt, every firewall_
+ * function below hands its work to either iptables or nftables
+ */
+unsigned int _firewall_backend = FIREWALL_BACKEND_IPTABLES;
+
+
+/*
+ * starts collecting firewall changes for one processing pass
+ */
+void firewall_batch_begin()
+{
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		nft_batch_open();
+	else
+		iptables_batch_begin();
+}
+
+
+/*
+ * applies every firewall change collected since firewall_batch_begin,
+ * returns 1 if everything was applied, otherwise 0
+ */
+unsigned int firewall_batch_commit()
+{
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		return nft_batch_commit();
+	
+	return iptables_batch_commit();
+}
+
+
+/*
+ * whitelists a host or cidr range, returns 1 if successful, otherwise 0
+ */
+unsigned int firewall_whitelist_host(char* host)
+{
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		return nft_update_set('A', NFT_ALLOWED_SET, host, 0);
+	
+	return iptables_whitelist_host(host);
+}
+
+
+/*
+ * removes a host or cidr range from the whitelist,
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int firewall_remove_host(char* host)
+{
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		return nft_update_set('D', NFT_ALLOWED_SET, host, 0);
+	
+	return iptables_remove_host(host);
+}
+
+
+/*
+ * starts logging every port a knocking host connects to
+ */
+void firewall_start_logging_host(char* host)
+{
+	//packet capture doesn't rely on firewall logging
+	if(_firewall_log_target[0] == '\0')
+		return;
+	
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		nft_update_set('A', NFT_KNOCKING_SET, host, _nft_knock_timeout_ms);
+	else
+		iptables_log_ports("1", "65535", host);
+}
+
+
+/*
+ * stops logging a host once it is done knocking
+ */
+void firewall_stop_logging_host(char* host)
+{
+	if(_firewall_log_target[0] == '\0')
+		return;
+	
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+		nft_update_set('D', NFT_KNOCKING_SET, host, 0);
+	else
+		iptables_stop_logging_host("1", "65535", host);
+}
+
+
+/*
+ * sets up basic firewall rules using a config struct
+ * i.e. blacklisting ports and logging knocks, whitelisted
+ * hosts are added on top of them afterwards
+ */
+void setup_firewall(Config* cfg)
+{	
+	if(cfg == NULL)
+		return;
+	
+	_firewall_backend = cfg->firewallBackend;
+	
+	//log knocks to syslog or nflog depending on the config
+	set_firewall_log_target(cfg);
+	
+	//nftables replaces its whole table in a single transaction
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+	{
+		if(nft_setup_table(cfg) == 0)
+			write_error("Failed to set up nftables table, check log for refused messages");
+	}
+	else
+		setup_iptables(cfg);
+}
+
+
+/*
+ * switches the firewall from the rules of the running config to those
+ * of a reloaded one without resetting it, whitelisted and knocking hosts
+ * are kept, iptables changes go out with the open batch while nftables
+ * replaces its rules in one transaction right away,
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int reload_firewall(Config* old, Config* cfg)
+{
+	if(_firewall_backend == FIREWALL_BACKEND_NFTABLES)
+	{
+		if(nft_replace_rules(cfg) == 0)
+			return 0;
+		
+		//only hosts that start knocking from now on get the new timeout
+		_nft_knock_timeout_ms = (uint64_t) (cfg->timeout + NFT_KNOCK_TIMEOUT_SLACK) * 1000;
+		return 1;
+	}
+	
+	iptables_reload_rules(old, cfg);
+	return 1;
+}
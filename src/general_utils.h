@@ -152,37 +152,91 @@ char* get_current_time()
 }
 
 
+#define NS_PER_SECOND 1000000000ULL
+
+
 /*
- * finds the difference between two time stamps
- * returns -1 if invalid timestamps
+ * returns the time in nanoseconds on the monotonic clock, it
+ * never jumps with the wall clock or wraps at midnight so every
+ * duration is measured with it, wall clock time is only used
+ * to stamp log lines
  */
-double time_diff_seconds(char* time1, char* time2)
-{	
-	if(time1 == NULL || time2 == NULL)
-		return -1;
-	
-	if(strcmp(time1, time2) == 0)
+uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+
+/*
+ * mixes the bits of an ipv4 address for hashing, addresses
+ * seen during a scan are sequential so they can't be used as is
+ */
+uint32_t hash_ipv4(uint32_t addr)
+{
+	uint32_t hash = addr;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+
+/*
+ * parses an entry of whitelist.txt, an address or a range in cidr
+ * notation, into an address and a mask in network byte order, the
+ * nftables sets are filled by it as well so both agree on every range,
+ * returns 1 if successful or 0 if it isn't valid
+ */
+unsigned int parse_whitelist_entry(char* entry, uint32_t* addr, uint32_t* mask)
+{
+	char text[INET_ADDRSTRLEN + 3];
+	size_t length = strcspn(entry, " \t\r\n");
+
+	if(length == 0 || length >= sizeof(text))
 		return 0;
+
+	memcpy(text, entry, length);
+	text[length] = '\0';
+
+	int prefix = 32;
+	char* slash = strchr(text, '/');
+	if(slash != NULL)
+	{
+		*slash = '\0';
+		char* end;
+		prefix = strtol(slash + 1, &end, 10);
+		if(end == slash + 1 || *end != '\0' || prefix < 0 || prefix > 32)
+			return 0;
+	}
+
+	if(inet_pton(AF_INET, text, addr) != 1)
+		return 0;
+
+	*mask = (prefix == 0) ? 0 : htonl(0xffffffffu << (32 - prefix));
+	*addr &= *mask;
+	return 1;
+}
+
+
+/*
+ * starts a thread with every signal blocked so signals are
+ * always handled by the main thread and its cleanup,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int start_thread(pthread_t* thread, void* (*function)(void*), void* arg)
+{
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	
+	int status = pthread_create(thread, NULL, function, arg);
 	
-	//instantiate structs
-	struct tm t1 = {0};
-	struct tm t2 = {0};
-    time_t tt1;
-	time_t tt2;
-	
-	//turn both inputs into tm structs
-    sscanf(time1, "%d:%d:%d", &t1.tm_hour, &t1.tm_min, &t1.tm_sec);
-    sscanf(time2, "%d:%d:%d", &t2.tm_hour, &t2.tm_min, &t2.tm_sec);
-	
-	//seconds since last epoch
-    t1.tm_year = t2.tm_year = 70; // years since 1900
-    t1.tm_mon = t2.tm_mon = 0; // months since January [0-11]
-    t1.tm_mday = t2.tm_mday = 1; // day of the month [1-31]
-    t1.tm_isdst = t2.tm_isdst = 0; // Daylight Saving Time flag
-    tt1 = mktime(&t1);
-    tt2 = mktime(&t2);
-	
-    return difftime(tt2, tt1);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return status == 0;
 }
 
 
@@ -0,0 +1,255 @@
+/*
+ * states a slot of the host table can be in, removed slots
+ * stay marked as deleted so probing past them keeps working
+ */
+#define HOST_SLOT_EMPTY 0
+#define HOST_SLOT_USED 1
+#define HOST_SLOT_DELETED 2
+
+//must be a power of two, the table doubles whenever it is half full
+#define HOST_TABLE_INITIAL_SIZE 1024
+
+
+/*
+ * a knocking host, stored inline in the table together
+ * with its sequence and keyed by its ipv4 address in
+ * network byte order, deadline is the tick its knock
+ * times out at
+ */
+typedef struct
+{
+	uint32_t addr;
+	unsigned int state;
+	uint64_t deadline;
+	Sequence seq;
+} HostEntry;
+
+
+/*
+ * this struct houses every host that is currently knocking in
+ * an open addressed hash table with linear probing, count and
+ * removal are O(1) and a knock costs a single probe sequence
+ */
+typedef struct
+{
+	HostEntry* entries;
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int deleted;
+} HostTable;
+
+
+/*
+ * allocates an empty host table with capacity slots,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must free table with free_host_table
+ */
+unsigned int initialize_host_table(HostTable* table, unsigned int capacity)
+{
+	if(table == NULL)
+		return 0;
+
+	table->entries = (HostEntry*) calloc(capacity, sizeof(HostEntry));
+	if(table->entries == NULL)
+		return 0;
+
+	table->capacity = capacity;
+	table->count = 0;
+	table->deleted = 0;
+	return 1;
+}
+
+
+/*
+ * returns the slot a probe for addr starts at
+ */
+unsigned int host_table_slot(HostTable* table, uint32_t addr)
+{
+	return hash_ipv4(addr) & (table->capacity - 1);
+}
+
+
+/*
+ * returns the entry of a host or NULL if it isn't knocking
+ */
+HostEntry* host_table_find(HostTable* table, uint32_t addr)
+{
+	if(table == NULL || table->entries == NULL)
+		return NULL;
+
+	unsigned int mask = table->capacity - 1;
+
+	for(unsigned int i = host_table_slot(table, addr); ; i = (i + 1) & mask)
+	{
+		HostEntry* entry = &table->entries[i];
+
+		if(entry->state == HOST_SLOT_EMPTY)
+			return NULL;
+
+		if(entry->state == HOST_SLOT_USED && entry->addr == addr)
+			return entry;
+	}
+}
+
+
+/*
+ * moves every host into a table with newCapacity slots,
+ * dropping the deleted markers along the way
+ * returns 1 if successful otherwise 0
+ */
+unsigned int resize_host_table(HostTable* table, unsigned int newCapacity)
+{
+	HostTable resized;
+	if(initialize_host_table(&resized, newCapacity) == 0)
+		return 0;
+
+	unsigned int mask = newCapacity - 1;
+
+	for(unsigned int i = 0; i < table->capacity; i++)
+	{
+		HostEntry* entry = &table->entries[i];
+		if(entry->state != HOST_SLOT_USED)
+			continue;
+
+		unsigned int j = host_table_slot(&resized, entry->addr);
+		while(resized.entries[j].state != HOST_SLOT_EMPTY)
+			j = (j + 1) & mask;
+
+		resized.entries[j] = *entry;
+		resized.count++;
+	}
+
+	free(table->entries);
+	*table = resized;
+	return 1;
+}
+
+
+/*
+ * returns the entry of a host, adding an empty one if the host
+ * isn't in the table yet, inserted is set to 1 in that case and
+ * to 0 otherwise, returns NULL if the table couldn't grow
+ *
+ * note: entries may move when a host is inserted so pointers
+ * from earlier lookups must not be used afterwards
+ */
+HostEntry* host_table_insert(HostTable* table, uint32_t addr, unsigned int* inserted)
+{
+	if(table == NULL || table->entries == NULL || inserted == NULL)
+		return NULL;
+
+	*inserted = 0;
+
+	//keep at least a quarter of the slots empty so probes stay short
+	if((table->count + table->deleted + 1) * 4 > table->capacity * 3)
+	{
+		unsigned int newCapacity = table->capacity;
+		if((table->count + 1) * 2 > table->capacity)
+			newCapacity *= 2;
+
+		if(resize_host_table(table, newCapacity) == 0)
+			return NULL;
+	}
+
+	unsigned int mask = table->capacity - 1;
+	HostEntry* reusable = NULL;
+
+	for(unsigned int i = host_table_slot(table, addr); ; i = (i + 1) & mask)
+	{
+		HostEntry* entry = &table->entries[i];
+
+		if(entry->state == HOST_SLOT_USED && entry->addr == addr)
+			return entry;
+
+		//the first deleted slot is reused once the host is known to be absent
+		if(entry->state == HOST_SLOT_DELETED && reusable == NULL)
+			reusable = entry;
+
+		if(entry->state == HOST_SLOT_EMPTY)
+		{
+			if(reusable != NULL)
+				table->deleted--;
+			else
+				reusable = entry;
+			break;
+		}
+	}
+
+	memset(reusable, 0, sizeof(HostEntry));
+	reusable->addr = addr;
+	reusable->state = HOST_SLOT_USED;
+	table->count++;
+	*inserted = 1;
+	return reusable;
+}
+
+
+/*
+ * removes a host from the table
+ */
+void host_table_remove(HostTable* table, HostEntry* entry)
+{
+	if(table == NULL || entry == NULL || entry->state != HOST_SLOT_USED)
+		return;
+
+	entry->state = HOST_SLOT_DELETED;
+	table->count--;
+	table->deleted++;
+}
+
+
+/*
+ * removes a host whose knock timed out and stops logging it
+ */
+void remove_expired_host(HostTable* table, HostEntry* entry)
+{
+	if(table == NULL || entry == NULL)
+		return;
+
+	char host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &entry->addr, host, sizeof(host));
+
+	write_log_two("Host timed out: ", host);
+	metric_add(METRIC_HOSTS_TIMED_OUT, 1);
+	firewall_stop_logging_host(host);
+	host_table_remove(table, entry);
+}
+
+
+/*
+ * prints every host in the table
+ */
+void print_host_table(HostTable* table)
+{
+	if(table == NULL || table->entries == NULL)
+		return;
+
+	for(unsigned int i = 0; i < table->capacity; i++)
+	{
+		HostEntry* entry = &table->entries[i];
+		if(entry->state != HOST_SLOT_USED)
+			continue;
+
+		char host[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &entry->addr, host, sizeof(host));
+		printf("host: %s\n", host);
+		print_sequence(&entry->seq);
+	}
+}
+
+
+/*
+ * destroys a host table
+ */
+void free_host_table(HostTable* table)
+{
+	if(table == NULL)
+		return;
+
+	free(table->entries);
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+	table->deleted = 0;
+}
@@ -0,0 +1,366 @@
+//libsystemd is loaded at runtime so speakeasy builds and runs without it
+#define JOURNAL_LIBRARY "libsystemd.so.0"
+
+//where the position in the journal is kept across restarts
+#define JOURNAL_CURSOR_FILE "journalcursor.txt"
+#define JOURNAL_CURSOR_INTERVAL_NS NS_PER_SECOND
+
+//values from sd-journal.h
+#define JOURNAL_LOCAL_ONLY (1 << 0)
+#define JOURNAL_SYSTEM (1 << 2)
+
+//kernel messages are cut off well before this
+#define JOURNAL_MESSAGE_SIZE 2048
+
+
+typedef struct sd_journal sd_journal;
+
+
+/*
+ * this struct houses the journal being read and the parts of
+ * the sd-journal api that are used, looked up in libsystemd:
+ * 	-savedNs is when the cursor was last written
+ * 	-unsaved is set once entries were read since then
+ */
+typedef struct
+{
+	void* library;
+	sd_journal* journal;
+	uint64_t savedNs;
+	unsigned int unsaved;
+
+	int (*open)(sd_journal** ret, int flags);
+	int (*open_directory)(sd_journal** ret, const char* path, int flags);
+	void (*close)(sd_journal* j);
+	int (*add_match)(sd_journal* j, const void* data, size_t size);
+	int (*next)(sd_journal* j);
+	int (*previous)(sd_journal* j);
+	int (*seek_tail)(sd_journal* j);
+	int (*seek_cursor)(sd_journal* j, const char* cursor);
+	int (*test_cursor)(sd_journal* j, const char* cursor);
+	int (*get_cursor)(sd_journal* j, char** cursor);
+	int (*get_data)(sd_journal* j, const char* field, const void** data, size_t* length);
+	int (*get_realtime_usec)(sd_journal* j, uint64_t* ret);
+	int (*get_fd)(sd_journal* j);
+	int (*get_events)(sd_journal* j);
+	int (*get_timeout)(sd_journal* j, uint64_t* timeoutUs);
+	int (*process)(sd_journal* j);
+} JournalReader;
+
+
+/*
+ * looks up every sd-journal function in libsystemd,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int load_journal_api(JournalReader* reader)
+{
+	reader->library = dlopen(JOURNAL_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	if(reader->library == NULL)
+		return 0;
+
+	struct
+	{
+		void** function;
+		const char* name;
+	} symbols[] =
+	{
+		{(void**) &reader->open, "sd_journal_open"},
+		{(void**) &reader->open_directory, "sd_journal_open_directory"},
+		{(void**) &reader->close, "sd_journal_close"},
+		{(void**) &reader->add_match, "sd_journal_add_match"},
+		{(void**) &reader->next, "sd_journal_next"},
+		{(void**) &reader->previous, "sd_journal_previous"},
+		{(void**) &reader->seek_tail, "sd_journal_seek_tail"},
+		{(void**) &reader->seek_cursor, "sd_journal_seek_cursor"},
+		{(void**) &reader->test_cursor, "sd_journal_test_cursor"},
+		{(void**) &reader->get_cursor, "sd_journal_get_cursor"},
+		{(void**) &reader->get_data, "sd_journal_get_data"},
+		{(void**) &reader->get_realtime_usec, "sd_journal_get_realtime_usec"},
+		{(void**) &reader->get_fd, "sd_journal_get_fd"},
+		{(void**) &reader->get_events, "sd_journal_get_events"},
+		{(void**) &reader->get_timeout, "sd_journal_get_timeout"},
+		{(void**) &reader->process, "sd_journal_process"},
+	};
+
+	for(unsigned int i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++)
+	{
+		*symbols[i].function = dlsym(reader->library, symbols[i].name);
+		if(*symbols[i].function == NULL)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * destroys a journal reader, closing the journal and libsystemd
+ */
+void free_journal_reader(JournalReader* reader)
+{
+	if(reader == NULL)
+		return;
+
+	if(reader->journal != NULL)
+		reader->close(reader->journal);
+
+	if(reader->library != NULL)
+		dlclose(reader->library);
+
+	memset(reader, 0, sizeof(JournalReader));
+}
+
+
+/*
+ * opens the journal files in directory, or the local system journal
+ * if directory is NULL, only messages the kernel itself logged are
+ * matched since the LOG target writes to the kernel log, the tag is
+ * part of the message text so that is left to the tag scan,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must free reader with free_journal_reader
+ */
+unsigned int open_journal_reader(JournalReader* reader, char* directory)
+{
+	if(reader == NULL)
+		return 0;
+
+	memset(reader, 0, sizeof(JournalReader));
+
+	if(load_journal_api(reader) == 0)
+	{
+		write_error("Failed to load " JOURNAL_LIBRARY ", is systemd installed?");
+		free_journal_reader(reader);
+		return 0;
+	}
+
+	int status;
+	if(directory != NULL)
+		status = reader->open_directory(&reader->journal, directory, 0);
+	else
+		status = reader->open(&reader->journal, JOURNAL_LOCAL_ONLY | JOURNAL_SYSTEM);
+
+	//matches on different fields must all hold, userspace writes
+	//to /dev/kmsg get their own identifier and are left out
+	const char* matches[] = {"_TRANSPORT=kernel", "SYSLOG_IDENTIFIER=kernel"};
+	for(unsigned int i = 0; status >= 0 && i < 2; i++)
+		status = reader->add_match(reader->journal, matches[i], strlen(matches[i]));
+
+	if(status < 0)
+	{
+		free_journal_reader(reader);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * writes the cursor of the last entry that was read to the cursor
+ * file, the file is replaced in one rename so it is never half written
+ * returns 1 if successful otherwise 0
+ */
+unsigned int save_journal_cursor(JournalReader* reader, const char* path)
+{
+	if(reader == NULL || reader->journal == NULL)
+		return 0;
+
+	//nothing has been read yet
+	char* cursor;
+	if(reader->get_cursor(reader->journal, &cursor) < 0)
+		return 0;
+
+	char tmpPath[PATH_MAX];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+	FILE* fptr = fopen(tmpPath, "w");
+	if(fptr == NULL)
+	{
+		free(cursor);
+		return 0;
+	}
+
+	int written = fprintf(fptr, "%s\n", cursor);
+	free(cursor);
+
+	if(fclose(fptr) != 0 || written < 0 || rename(tmpPath, path) == -1)
+	{
+		unlink(tmpPath);
+		return 0;
+	}
+
+	reader->unsaved = 0;
+	reader->savedNs = monotonic_ns();
+	return 1;
+}
+
+
+/*
+ * saves the cursor if entries were read since it was last
+ * saved, at most once every JOURNAL_CURSOR_INTERVAL_NS
+ */
+void save_journal_cursor_throttled(JournalReader* reader, const char* path)
+{
+	if(reader == NULL || reader->unsaved == 0)
+		return;
+
+	if(monotonic_ns() - reader->savedNs < JOURNAL_CURSOR_INTERVAL_NS)
+		return;
+
+	if(save_journal_cursor(reader, path) == 0)
+		write_error("Failed to save journal cursor to " JOURNAL_CURSOR_FILE);
+}
+
+
+/*
+ * positions the journal right after the entry saved in the cursor
+ * file so nothing is read twice, without a usable cursor only
+ * entries written from now on are read,
+ * returns 1 if the saved cursor was used otherwise 0
+ */
+unsigned int resume_journal_reader(JournalReader* reader, const char* path)
+{
+	char cursor[1024];
+	FILE* fptr = read_file(path);
+	unsigned int loaded = 0;
+
+	if(fptr != NULL)
+	{
+		loaded = fgets(cursor, sizeof(cursor), fptr) != NULL;
+		fclose(fptr);
+		cursor[strcspn(cursor, "\n")] = '\0';
+	}
+
+	if(loaded && cursor[0] != '\0' && reader->seek_cursor(reader->journal, cursor) >= 0)
+	{
+		//seeking lands on the saved entry, or the one after it if it was vacuumed,
+		//which hasn't been read yet and has to be stepped back over
+		if(reader->next(reader->journal) > 0 && reader->test_cursor(reader->journal, cursor) <= 0)
+			reader->previous(reader->journal);
+
+		return 1;
+	}
+
+	reader->seek_tail(reader->journal);
+	reader->previous(reader->journal);
+	return 0;
+}
+
+
+/*
+ * returns how long ago the current journal entry was written, going
+ * by the wall clock since that is all the journal keeps across boots,
+ * an entry stamped in the future counts as just written
+ */
+uint64_t journal_entry_age_ns(JournalReader* reader)
+{
+	uint64_t entryUs;
+	if(reader->get_realtime_usec(reader->journal, &entryUs) < 0)
+		return 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t nowNs = (uint64_t) ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+
+	return (nowNs > entryUs * 1000) ? nowNs - entryUs * 1000 : 0;
+}
+
+
+/*
+ * reads every kernel message added since the last call and hands the
+ * ones carrying the speakeasy tag to handler as a LogEntry, each one
+ * is aged by its journal timestamp so knocks read back after a restart
+ * aren't taken as new, returns the number of entries or -1 on a read error
+ */
+int read_journal_entries(JournalReader* reader, void (*handler)(LogEntry*))
+{
+	if(reader == NULL || reader->journal == NULL || handler == NULL)
+		return -1;
+
+	size_t tagLen = strlen(LOG_READER_TAG);
+	int entries = 0;
+	int status;
+
+	while((status = reader->next(reader->journal)) > 0)
+	{
+		reader->unsaved = 1;
+		metric_add(METRIC_RECORDS_SCANNED, 1);
+
+		const void* data;
+		size_t length;
+		if(reader->get_data(reader->journal, "MESSAGE", &data, &length) < 0)
+			continue;
+
+		//data is "MESSAGE=..." and isn't null terminated
+		const char* message = (const char*) data + strlen("MESSAGE=");
+		length -= strlen("MESSAGE=");
+
+		if(tag_scan(message, length, LOG_READER_TAG, tagLen) == NULL)
+			continue;
+
+		char line[JOURNAL_MESSAGE_SIZE];
+		if(length >= sizeof(line))
+			continue;
+
+		metric_add(METRIC_TAGGED_LINES, 1);
+		memcpy(line, message, length);
+		line[length] = '\0';
+
+		LogEntry log;
+		uint64_t startNs = monotonic_ns();
+		unsigned int parsed = construct_log(line, &log);
+		metric_observe(METRIC_PARSE_SECONDS, startNs);
+
+		if(parsed)
+		{
+			metric_add(METRIC_ENTRIES_PARSED, 1);
+			log.ageNs = journal_entry_age_ns(reader);
+			handler(&log);
+			entries++;
+		}
+	}
+
+	return (status < 0) ? -1 : entries;
+}
+
+
+/*
+ * blocks until the journal changes, wakeFd becomes readable or
+ * timeoutMs has passed, a timeout of -1 blocks indefinitely and a
+ * wakeFd of -1 is left out, this is what sd_journal_wait does with
+ * one more descriptor to watch, returns -1 on error
+ */
+int wait_for_journal(JournalReader* reader, int timeoutMs, int wakeFd)
+{
+	int fd = reader->get_fd(reader->journal);
+	int events = reader->get_events(reader->journal);
+	if(fd < 0 || events < 0)
+		return -1;
+
+	//the journal may need to look at its files again before then,
+	//its timeout is on the monotonic clock
+	uint64_t untilUs;
+	if(reader->get_timeout(reader->journal, &untilUs) >= 0 && untilUs != (uint64_t) -1)
+	{
+		uint64_t nowUs = monotonic_ns() / 1000;
+		uint64_t journalMs = (untilUs > nowUs) ? (untilUs - nowUs + 999) / 1000 : 0;
+
+		if(journalMs < INT_MAX && (timeoutMs < 0 || journalMs < (uint64_t) timeoutMs))
+			timeoutMs = (int) journalMs;
+	}
+
+	struct pollfd pfds[2] = {{.fd = fd, .events = events}, {.fd = wakeFd, .events = POLLIN}};
+	int ready = poll(pfds, 2, timeoutMs);
+
+	//interrupted by a signal is treated like a timeout
+	if(ready == -1 && errno == EINTR)
+		return 0;
+
+	if(ready == -1)
+		return -1;
+
+	//the journal has to see its inotify events after every wakeup
+	int status = reader->process(reader->journal);
+	return (status < 0) ? -1 : status;
+}
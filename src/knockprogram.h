@@ -0,0 +1,390 @@
+/*
+ * results of feeding a knock to the compiled sequences:
+ * 	-KNOCK_FAILED the port doesn't continue any sequence
+ * 	-KNOCK_ADVANCED the host is still on track
+ * 	-KNOCK_COMPLETED the host finished a sequence
+ * 	-KNOCK_IGNORED the host hit a first port again which is
+ * 	 most likely a retransmitted SYN, so it is left alone
+ */
+#define KNOCK_FAILED 0
+#define KNOCK_ADVANCED 1
+#define KNOCK_COMPLETED 2
+#define KNOCK_IGNORED 3
+
+//node 0 is the root of the trie, nodes are addressed with 16 bits
+#define KNOCK_ROOT 0
+#define KNOCK_NO_NODE 0xffffffff
+#define KNOCK_MAX_NODES 65535
+
+//longest progress a knocking host keeps when config.txt is reloaded
+#define KNOCK_MAX_PATH 256
+
+#define KNOCK_NAME_SIZE 32
+#define KNOCK_DEFAULT_NAME "default"
+
+
+/*
+ * every knock sequence compiled into one prefix trie so sequences
+ * share their common prefixes, a host's progress is the node it is at
+ * 	-transitions is an open addressed hash from (node << 16) | port
+ * 	 to the child node, so a knock costs one lookup no matter how many
+ * 	 sequences there are, a key of 0 marks an empty slot since port 0
+ * 	 is never knocked
+ * 	-sequenceAt holds the sequence that completes at each node or -1,
+ * 	 a sequence may not be a prefix of another since the longer one
+ * 	 could never be completed
+ * 	-ports and entryPorts list every distinct port and every first
+ * 	 port, for the firewall rules and packet filters
+ */
+typedef struct
+{
+	uint32_t* transitionKeys;
+	uint32_t* transitionNodes;
+	unsigned int transitionMask;
+	int* sequenceAt;
+	unsigned int numNodes;
+	char (*names)[KNOCK_NAME_SIZE];
+	unsigned int numSequences;
+	uint16_t* ports;
+	unsigned int numPorts;
+	uint16_t* entryPorts;
+	unsigned int numEntryPorts;
+} KnockProgram;
+
+
+/*
+ * returns the node reached by knocking port from node
+ * or KNOCK_NO_NODE if no sequence continues that way
+ */
+uint32_t knock_program_next(KnockProgram* program, uint32_t node, uint16_t port)
+{
+	uint32_t key = (node << 16) | port;
+	uint32_t hash = key * 2654435761u;
+
+	for(unsigned int i = (hash >> 16) & program->transitionMask; ; i = (i + 1) & program->transitionMask)
+	{
+		if(program->transitionKeys[i] == key)
+			return program->transitionNodes[i];
+
+		if(program->transitionKeys[i] == 0)
+			return KNOCK_NO_NODE;
+	}
+}
+
+
+/*
+ * adds port to a list of distinct ports
+ */
+void knock_program_note_port(uint16_t* ports, unsigned int* numPorts, uint16_t port)
+{
+	for(unsigned int i = 0; i < *numPorts; i++)
+	{
+		if(ports[i] == port)
+			return;
+	}
+	ports[(*numPorts)++] = port;
+}
+
+
+/*
+ * returns the port in a port string or -1 if it isn't a valid port
+ */
+long parse_knock_port(char* portStr)
+{
+	char* end;
+	long port = strtol(portStr, &end, 10);
+
+	//sanitizing turns stray whitespace into spaces
+	while(*end == ' ')
+		end++;
+
+	if(end == portStr || *end != '\0' || port <= 0 || port > 65535)
+		return -1;
+
+	return port;
+}
+
+
+/*
+ * walks the trie along ports, adding the nodes that are missing,
+ * and marks the last one as the end of sequence number index
+ * returns 1 if successful or 0 if a port is invalid
+ */
+unsigned int knock_program_add_sequence(KnockProgram* program, char** ports, int index)
+{
+	uint32_t node = KNOCK_ROOT;
+
+	for(unsigned int i = 0; ports[i] != NULL; i++)
+	{
+		long port = parse_knock_port(ports[i]);
+		if(port == -1)
+			return 0;
+
+		knock_program_note_port(program->ports, &program->numPorts, port);
+		if(i == 0)
+			knock_program_note_port(program->entryPorts, &program->numEntryPorts, port);
+
+		uint32_t next = knock_program_next(program, node, port);
+		if(next == KNOCK_NO_NODE)
+		{
+			//room was made for every port up front
+			next = program->numNodes++;
+			program->sequenceAt[next] = -1;
+
+			uint32_t key = (node << 16) | port;
+			unsigned int slot = ((key * 2654435761u) >> 16) & program->transitionMask;
+			while(program->transitionKeys[slot] != 0)
+				slot = (slot + 1) & program->transitionMask;
+
+			program->transitionKeys[slot] = key;
+			program->transitionNodes[slot] = next;
+		}
+		node = next;
+	}
+
+	//a sequence that was configured twice keeps its first name
+	if(program->sequenceAt[node] == -1)
+		program->sequenceAt[node] = index;
+
+	return 1;
+}
+
+
+/*
+ * walks the trie along ports, returns the index of a sequence that is
+ * completed before the last port, which makes the rest unreachable,
+ * or -1 if there is none
+ */
+int knock_program_shadowing_sequence(KnockProgram* program, char** ports)
+{
+	uint32_t node = KNOCK_ROOT;
+
+	for(unsigned int i = 0; ports[i] != NULL && ports[i + 1] != NULL; i++)
+	{
+		node = knock_program_next(program, node, parse_knock_port(ports[i]));
+		if(node == KNOCK_NO_NODE)
+			return -1;
+
+		if(program->sequenceAt[node] != -1)
+			return program->sequenceAt[node];
+	}
+
+	return -1;
+}
+
+
+/*
+ * destroys the tables of a knock program
+ */
+void free_knock_program(KnockProgram* program)
+{
+	if(program == NULL)
+		return;
+
+	free(program->transitionKeys);
+	free(program->transitionNodes);
+	free(program->sequenceAt);
+	free(program->names);
+	free(program->ports);
+	free(program->entryPorts);
+	memset(program, 0, sizeof(KnockProgram));
+}
+
+
+/*
+ * compiles portsToKnock (named "default", it may be empty) and every
+ * "name:port,port,..." entry of knockSequences into a knock program,
+ * returns 1 if successful or 0 if a sequence is malformed, shorter
+ * than two ports, starts with all of another sequence or there are
+ * no sequences at all
+ *
+ * side effect: must free program with free_knock_program
+ */
+unsigned int compile_knock_program(char** portsToKnock, char** knockSequences, KnockProgram* program)
+{
+	if(portsToKnock == NULL || knockSequences == NULL || program == NULL)
+		return 0;
+
+	memset(program, 0, sizeof(KnockProgram));
+
+	//split every sequence into its name and its ports first
+	unsigned int numLines = str_array_size(knockSequences);
+	char*** sequences = (char***) calloc(numLines + 1, sizeof(char**));
+	char (*names)[KNOCK_NAME_SIZE] = calloc(numLines + 1, KNOCK_NAME_SIZE);
+	unsigned int numSequences = 0;
+	unsigned int totalPorts = 0;
+	unsigned int status = sequences != NULL && names != NULL;
+
+	if(status && portsToKnock[0] != NULL && portsToKnock[0][0] != '\0')
+	{
+		strcpy(names[numSequences], KNOCK_DEFAULT_NAME);
+		sequences[numSequences++] = portsToKnock;
+	}
+
+	for(unsigned int i = 0; status && i < numLines; i++)
+	{
+		char* colon = strchr(knockSequences[i], ':');
+		size_t nameLen = (colon != NULL) ? (size_t) (colon - knockSequences[i]) : 0;
+
+		if(nameLen == 0 || nameLen >= KNOCK_NAME_SIZE)
+		{
+			status = 0;
+			break;
+		}
+
+		memcpy(names[numSequences], knockSequences[i], nameLen);
+		sequences[numSequences] = text_series_to_str_array(colon + 1);
+
+		if(sequences[numSequences] == NULL)
+		{
+			status = 0;
+			break;
+		}
+		sanitize_array_dyn(sequences[numSequences]);
+		numSequences++;
+	}
+
+	for(unsigned int i = 0; status && i < numSequences; i++)
+	{
+		unsigned int length = str_array_size(sequences[i]);
+		status = length >= 2;
+		totalPorts += length;
+	}
+
+	status &= numSequences > 0 && totalPorts < KNOCK_MAX_NODES;
+
+	//the trie can't need more nodes or transitions than there are ports
+	unsigned int capacity = 16;
+	while(status && capacity < totalPorts * 2)
+		capacity *= 2;
+
+	if(status)
+	{
+		program->transitionKeys = (uint32_t*) calloc(capacity, sizeof(uint32_t));
+		program->transitionNodes = (uint32_t*) calloc(capacity, sizeof(uint32_t));
+		program->sequenceAt = (int*) malloc(sizeof(int) * (totalPorts + 1));
+		program->ports = (uint16_t*) malloc(sizeof(uint16_t) * totalPorts);
+		program->entryPorts = (uint16_t*) malloc(sizeof(uint16_t) * numSequences);
+		program->transitionMask = capacity - 1;
+
+		status = program->transitionKeys != NULL && program->transitionNodes != NULL &&
+				 program->sequenceAt != NULL && program->ports != NULL && program->entryPorts != NULL;
+	}
+
+	if(status)
+	{
+		program->sequenceAt[KNOCK_ROOT] = -1;
+		program->numNodes = 1;
+		program->names = names;
+		program->numSequences = numSequences;
+		names = NULL;
+
+		for(unsigned int i = 0; status && i < numSequences; i++)
+			status = knock_program_add_sequence(program, sequences[i], i);
+	}
+
+	//a sequence that starts with all of another one could never be completed
+	for(unsigned int i = 0; status && i < numSequences; i++)
+	{
+		int shorter = knock_program_shadowing_sequence(program, sequences[i]);
+		if(shorter != -1)
+		{
+			char message[128];
+			snprintf(message, sizeof(message), "Knock sequence %s can never be completed, it starts with all of sequence %s",
+					 program->names[i], program->names[shorter]);
+			write_error(message);
+			status = 0;
+		}
+	}
+
+	//portsToKnock belongs to the config, the rest were split here
+	unsigned int firstSplit = (numSequences > 0 && sequences[0] == portsToKnock) ? 1 : 0;
+	for(unsigned int i = firstSplit; sequences != NULL && i < numSequences; i++)
+		free_all_double_char((char**[]) {sequences[i]}, 1);
+
+	free(sequences);
+	free(names);
+
+	if(status == 0)
+		free_knock_program(program);
+
+	return status;
+}
+
+
+/*
+ * feeds a knock to the program for a host that is at node, node is
+ * moved along if the port continues a sequence, if the sequence is
+ * completed node is left at its end so its name can be looked up
+ * returns KNOCK_COMPLETED, KNOCK_ADVANCED, KNOCK_IGNORED or KNOCK_FAILED
+ */
+int knock_program_advance(KnockProgram* program, uint32_t* node, uint16_t port)
+{
+	uint32_t next = knock_program_next(program, *node, port);
+
+	if(next == KNOCK_NO_NODE)
+	{
+		if(knock_program_next(program, KNOCK_ROOT, port) != KNOCK_NO_NODE)
+			return KNOCK_IGNORED;
+
+		return KNOCK_FAILED;
+	}
+
+	*node = next;
+
+	if(program->sequenceAt[next] != -1)
+		return KNOCK_COMPLETED;
+
+	return KNOCK_ADVANCED;
+}
+
+
+/*
+ * writes the ports that lead from the root to node into ports, first
+ * port first, every node but the root is reached by exactly one
+ * transition so the path is found walking back up from node,
+ * returns the number of ports or -1 if there are more than maxPorts
+ */
+int knock_program_path(KnockProgram* program, uint32_t node, uint16_t* ports, unsigned int maxPorts)
+{
+	unsigned int length = 0;
+
+	while(node != KNOCK_ROOT)
+	{
+		if(length == maxPorts || node >= program->numNodes)
+			return -1;
+
+		unsigned int i = 0;
+		while(i <= program->transitionMask &&
+			  (program->transitionKeys[i] == 0 || program->transitionNodes[i] != node))
+			i++;
+
+		if(i > program->transitionMask)
+			return -1;
+
+		ports[length++] = program->transitionKeys[i] & 0xffff;
+		node = program->transitionKeys[i] >> 16;
+	}
+
+	//the walk collected them last port first
+	for(unsigned int i = 0; i < length / 2; i++)
+	{
+		uint16_t port = ports[i];
+		ports[i] = ports[length - 1 - i];
+		ports[length - 1 - i] = port;
+	}
+
+	return length;
+}
+
+
+/*
+ * returns the name of the sequence that completes at node
+ */
+char* knock_program_sequence_name(KnockProgram* program, uint32_t node)
+{
+	if(node >= program->numNodes || program->sequenceAt[node] == -1)
+		return "";
+
+	return program->names[program->sequenceAt[node]];
+}
@@ -3,6 +3,12 @@
  *	source IP address
  *	destination IP address
  * 	destination port
+ * 	source port
+ * 	protocol
+ * 	interface the packet came in on
+ * 	kernel timestamp in microseconds since boot, 0 if it wasn't logged
+ * 	how long ago the knock was made if it was read back from before
+ * 	a restart or the journal stamped it, 0 for knocks that just arrived
  */
 typedef struct
 {
@@ -10,71 +16,202 @@ typedef struct
 	char src[16];
 	char dst[16];
 	char dpt[6];
+	char spt[6];
+	char proto[8];
+	char in[16];
+	uint64_t kernelTimeUs;
+	uint64_t ageNs;
 } LogEntry;
 
 
 /*
- * this function destroys a log
+ * classes of characters allowed in the fields of a log entry,
+ * values are checked against these instead of being sanitized
+ * since a valid field never contains anything else
  */
-void free_log(LogEntry* log)
+#define LOG_CHAR_DIGIT 1
+#define LOG_CHAR_ADDR 2
+#define LOG_CHAR_PROTO 4
+#define LOG_CHAR_IFACE 8
+
+static const unsigned char _log_char_class[256] =
 {
-	if(log == NULL)
-		return;
-	
-	free(log);
+	['0' ... '9'] = LOG_CHAR_DIGIT | LOG_CHAR_ADDR | LOG_CHAR_PROTO | LOG_CHAR_IFACE,
+	['.'] = LOG_CHAR_ADDR | LOG_CHAR_IFACE,
+	['A' ... 'Z'] = LOG_CHAR_PROTO | LOG_CHAR_IFACE,
+	['a' ... 'z'] = LOG_CHAR_IFACE,
+	['_'] = LOG_CHAR_IFACE,
+	['-'] = LOG_CHAR_IFACE,
+};
+
+
+/*
+ * copies the value of a field into dest if all of its characters
+ * are of the given class and it fits, a field that was already filled
+ * is left alone so the first occurrence wins like it did with strstr
+ * returns 1 if the field was copied otherwise 0
+ */
+unsigned int copy_log_field(char* dest, size_t destSize, const char* value, size_t len, unsigned char charClass)
+{
+	if(dest[0] != '\0' || len == 0 || len >= destSize)
+		return 0;
+
+	for(size_t i = 0; i < len; i++)
+	{
+		if((_log_char_class[(unsigned char) value[i]] & charClass) == 0)
+			return 0;
+	}
+
+	memcpy(dest, value, len);
+	dest[len] = '\0';
+	return 1;
 }
-	
+
 
 /*
- * constructs a log entry from a given string
- * returns a pointer to a LogEntry struct
- * or null if the given string is null
- * or doesn't contain a valid log entry
- * 
- * side effect: must be freed later
+ * parses the "[seconds.micros]" kernel timestamp at the start of
+ * a bracket, the seconds may be padded with spaces, returns a pointer
+ * past the closing bracket or NULL if it isn't a timestamp
  */
-LogEntry* construct_log(char* givenString)
+const char* parse_kernel_timestamp(const char* cursor, uint64_t* timeUs)
 {
-	if(givenString == NULL)
-		return NULL;
-		
-	//extraction of items from log entry
-	char* src = get_parameter(givenString, "SRC=");
-	char* dst = get_parameter(givenString, "DST=");
-	char* dpt = get_parameter(givenString, "DPT=");
-	
-	//make an array of the pointers
-	void* ptrs[] = {src, dst, dpt};
-	
-	//verify pointer integrity before proceeding
-	if(check_ptr_integrity(ptrs, 3) == 0)
+	while(*cursor == ' ')
+		cursor++;
+
+	if((_log_char_class[(unsigned char) *cursor] & LOG_CHAR_DIGIT) == 0)
 		return NULL;
-	
-	//proceed since pointers are valid
-	LogEntry* log = (LogEntry*) malloc(sizeof(LogEntry));
-		
-	//check if malloc succeeded
-	if(log == NULL)
+
+	uint64_t seconds = 0;
+	while(_log_char_class[(unsigned char) *cursor] & LOG_CHAR_DIGIT)
+		seconds = seconds * 10 + (*cursor++ - '0');
+
+	uint64_t micros = 0;
+	unsigned int digits = 0;
+	if(*cursor == '.')
+	{
+		cursor++;
+		while(_log_char_class[(unsigned char) *cursor] & LOG_CHAR_DIGIT)
+		{
+			//anything past microseconds is dropped
+			if(digits++ < 6)
+				micros = micros * 10 + (*cursor - '0');
+			cursor++;
+		}
+	}
+
+	if(*cursor != ']')
 		return NULL;
-	
-	//sanitize inputs
-	sanitize_dyn(src);
-	sanitize_dyn(dst);
-	sanitize_dyn(dpt);
-	
-	//copy them over
-	strncpy(log->src, src, 15);
-	strncpy(log->dst, dst, 15);
-	strncpy(log->dpt, dpt, 5);
-	
-	//null terminate
-	log->src[15] = '\0';
-	log->dst[15] = '\0';
-	log->dpt[5] = '\0';
-	
-	//free and return
-	free_all(ptrs, 3);
-	return log;
+
+	while(digits++ < 6)
+		micros *= 10;
+
+	*timeUs = seconds * 1000000 + micros;
+	return cursor + 1;
+}
+
+
+/*
+ * fills log from a LOG target line in a single forward pass without
+ * allocating, the line is split into space separated KEY=value fields
+ * and only the ones that are needed are copied out
+ * returns 1 if the line holds a valid source, destination and
+ * destination port otherwise 0
+ */
+unsigned int construct_log(const char* givenString, LogEntry* log)
+{
+	if(givenString == NULL || log == NULL)
+		return 0;
+
+	memset(log, 0, sizeof(LogEntry));
+	const char* cursor = givenString;
+
+	while(*cursor != '\0' && *cursor != '\n')
+	{
+		if(*cursor == ' ')
+		{
+			cursor++;
+			continue;
+		}
+
+		//the kernel timestamp comes before any field
+		if(*cursor == '[' && log->kernelTimeUs == 0 && log->src[0] == '\0')
+		{
+			const char* end = parse_kernel_timestamp(cursor + 1, &log->kernelTimeUs);
+			if(end != NULL)
+			{
+				cursor = end;
+				continue;
+			}
+		}
+
+		//find the end of the token and its equals sign if it has one
+		const char* token = cursor;
+		const char* equals = NULL;
+		while(*cursor != '\0' && *cursor != '\n' && *cursor != ' ')
+		{
+			if(*cursor == '=' && equals == NULL)
+				equals = cursor;
+			cursor++;
+		}
+
+		if(equals == NULL)
+			continue;
+
+		size_t keyLen = equals - token;
+		const char* value = equals + 1;
+		size_t valueLen = cursor - value;
+
+		if(keyLen == 3 && memcmp(token, "SRC", 3) == 0)
+			copy_log_field(log->src, sizeof(log->src), value, valueLen, LOG_CHAR_ADDR);
+		else if(keyLen == 3 && memcmp(token, "DST", 3) == 0)
+			copy_log_field(log->dst, sizeof(log->dst), value, valueLen, LOG_CHAR_ADDR);
+		else if(keyLen == 3 && memcmp(token, "DPT", 3) == 0)
+			copy_log_field(log->dpt, sizeof(log->dpt), value, valueLen, LOG_CHAR_DIGIT);
+		else if(keyLen == 3 && memcmp(token, "SPT", 3) == 0)
+			copy_log_field(log->spt, sizeof(log->spt), value, valueLen, LOG_CHAR_DIGIT);
+		else if(keyLen == 5 && memcmp(token, "PROTO", 5) == 0)
+			copy_log_field(log->proto, sizeof(log->proto), value, valueLen, LOG_CHAR_PROTO);
+		else if(keyLen == 2 && memcmp(token, "IN", 2) == 0)
+			copy_log_field(log->in, sizeof(log->in), value, valueLen, LOG_CHAR_IFACE);
+	}
+
+	return log->src[0] != '\0' && log->dst[0] != '\0' && log->dpt[0] != '\0';
+}
+
+
+/*
+ * fills a LogEntry from a raw ip packet, as handed over by the
+ * nflog and packet capture backends,
+ * returns 1 if the packet was a tcp packet, otherwise 0
+ */
+unsigned int construct_log_from_packet(const unsigned char* packet, size_t len, LogEntry* log)
+{
+	if(packet == NULL || log == NULL || len < sizeof(struct iphdr))
+		return 0;
+
+	const struct iphdr* ip = (const struct iphdr*) packet;
+	size_t ipLen = ip->ihl * 4;
+
+	if(ip->version != 4 || ip->protocol != IPPROTO_TCP || ipLen < sizeof(struct iphdr))
+		return 0;
+
+	//the destination port sits two bytes into the tcp header
+	if(len < ipLen + 4)
+		return 0;
+
+	uint16_t dport;
+	memcpy(&dport, packet + ipLen + 2, sizeof(dport));
+
+	uint16_t sport;
+	memcpy(&sport, packet + ipLen, sizeof(sport));
+
+	memset(log, 0, sizeof(LogEntry));
+	inet_ntop(AF_INET, &ip->saddr, log->src, sizeof(log->src));
+	inet_ntop(AF_INET, &ip->daddr, log->dst, sizeof(log->dst));
+	snprintf(log->dpt, sizeof(log->dpt), "%u", ntohs(dport));
+	snprintf(log->spt, sizeof(log->spt), "%u", ntohs(sport));
+	strcpy(log->proto, "TCP");
+	return 1;
 }
 
 
@@ -93,5 +230,13 @@ void print_log(LogEntry* log)
 
 	printf("dst: %s\n", log->dst);
 	
-	printf("dpt: %s\n\n", log->dpt);
+	printf("dpt: %s\n", log->dpt);
+
+	printf("spt: %s\n", log->spt);
+
+	printf("proto: %s\n", log->proto);
+
+	printf("in: %s\n", log->in);
+
+	printf("kernel time: %llu us\n\n", (unsigned long long) log->kernelTimeUs);
 }
@@ -1,3 +1,428 @@
+#define LOG_FILE "log.txt"
+#define LOG_ROTATED_FILE "log.txt.1"
+
+/*
+ * these are the possible values of logLevel in config.txt, messages
+ * below the configured level are dropped before they are queued
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+//once log.txt would grow past this it is moved to log.txt.1
+#define LOG_ROTATE_SIZE (8 * 1024 * 1024)
+
+//must be a power of two, messages are cut off at LOG_MESSAGE_SIZE
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 384
+#define LOG_LINE_SIZE (LOG_MESSAGE_SIZE + 64)
+
+//how many lines go out in one writev and how often the ring is drained
+#define LOG_BATCH_LINES 64
+#define LOG_FLUSH_INTERVAL_NS 50000000
+
+//how long identical messages are held back before they are counted
+#define LOG_REPEAT_INTERVAL_SECONDS 30
+
+
+/*
+ * a message waiting in the ring, sequence tells producers and the
+ * writer thread whose turn it is to use the slot
+ */
+typedef struct
+{
+	unsigned int sequence;
+	unsigned int level;
+	time_t time;
+	char message[LOG_MESSAGE_SIZE];
+} LogSlot;
+
+
+/*
+ * this struct houses the logger, messages are copied into a ring
+ * without locks and written to log.txt and stdout by one thread:
+ * 	-head is the next slot a producer claims, tail the next one the
+ * 	 writer thread reads, dropped counts messages that found it full
+ * 	-fd stays open and size tracks log.txt for rotation
+ * 	-last is the last message written, identical ones after it are
+ * 	 only counted in repeats, starting at repeatStart
+ * 	-lines and iov collect one batch for writev
+ */
+typedef struct
+{
+	LogSlot slots[LOG_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+	unsigned int minLevel;
+
+	unsigned int running;
+	unsigned int stopping;
+	pthread_t thread;
+
+	int fd;
+	off_t size;
+
+	char last[LOG_MESSAGE_SIZE];
+	unsigned int lastLevel;
+	unsigned int repeats;
+	time_t repeatStart;
+
+	char lines[LOG_BATCH_LINES][LOG_LINE_SIZE];
+	struct iovec iov[LOG_BATCH_LINES];
+	unsigned int numLines;
+} Logger;
+
+Logger _logger = {.fd = -1, .minLevel = LOG_LEVEL_INFO};
+
+
+/*
+ * turns the logLevel parameter into one of the LOG_LEVEL values,
+ * a missing parameter means info, returns -1 if the level is unknown
+ */
+int parse_log_level(char* logLevel)
+{
+	if(logLevel == NULL)
+		return LOG_LEVEL_INFO;
+
+	logLevel[strcspn(logLevel, "\n")] = '\0';
+
+	const char* names[] = {"debug", "info", "warning", "error"};
+	for(int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++)
+	{
+		if(strcmp(logLevel, names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/*
+ * sets the lowest level of messages that are logged
+ */
+void set_log_level(unsigned int level)
+{
+	__atomic_store_n(&_logger.minLevel, level, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * opens log.txt for appending if it isn't open yet,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int open_log_file(Logger* logger)
+{
+	if(logger->fd != -1)
+		return 1;
+
+	logger->fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if(logger->fd == -1)
+		return 0;
+
+	struct stat st;
+	logger->size = (fstat(logger->fd, &st) == 0) ? st.st_size : 0;
+	return 1;
+}
+
+
+/*
+ * moves a full log.txt to log.txt.1, replacing the one before it,
+ * and starts a new log.txt
+ */
+void rotate_log_file(Logger* logger)
+{
+	close(logger->fd);
+	logger->fd = -1;
+
+	rename(LOG_FILE, LOG_ROTATED_FILE);
+	open_log_file(logger);
+}
+
+
+/*
+ * writes the collected lines to log.txt and stdout with one writev
+ * each, log.txt is rotated first if they would take it past
+ * LOG_ROTATE_SIZE, returns 1 if successful otherwise 0
+ */
+unsigned int flush_log_batch(Logger* logger)
+{
+	if(logger->numLines == 0)
+		return 1;
+
+	size_t length = 0;
+	for(unsigned int i = 0; i < logger->numLines; i++)
+		length += logger->iov[i].iov_len;
+
+	if(logger->fd != -1 && logger->size > 0 && logger->size + (off_t) length > LOG_ROTATE_SIZE)
+		rotate_log_file(logger);
+
+	unsigned int status = 0;
+	if(open_log_file(logger))
+	{
+		ssize_t written = writev(logger->fd, logger->iov, logger->numLines);
+		if(written > 0)
+			logger->size += written;
+		status = written == (ssize_t) length;
+	}
+
+	//the terminal copy is best effort
+	writev(STDOUT_FILENO, logger->iov, logger->numLines);
+
+	logger->numLines = 0;
+	return status;
+}
+
+
+/*
+ * formats a message into the next line of the batch,
+ * the batch is written out first if it is full
+ */
+void add_log_line(Logger* logger, time_t time, unsigned int level, const char* message)
+{
+	if(logger->numLines == LOG_BATCH_LINES)
+		flush_log_batch(logger);
+
+	const char* names[] = {"DEBUG: ", "", "WARNING: ", "ERROR: "};
+
+	char stamp[32];
+	struct tm tInfo;
+	localtime_r(&time, &tInfo);
+	strftime(stamp, sizeof(stamp), "%b %d %H:%M:%S", &tInfo);
+
+	char* line = logger->lines[logger->numLines];
+	int length = snprintf(line, LOG_LINE_SIZE, "[%s] Speakeasy-LOG: %s%s\n", stamp, names[level], message);
+
+	//a cut off line still ends with its newline
+	if(length >= LOG_LINE_SIZE)
+	{
+		length = LOG_LINE_SIZE - 1;
+		line[length - 1] = '\n';
+	}
+
+	logger->iov[logger->numLines].iov_base = line;
+	logger->iov[logger->numLines].iov_len = length;
+	logger->numLines++;
+}
+
+
+/*
+ * writes how often the last message was held back, if it was
+ */
+void flush_log_repeats(Logger* logger, time_t time)
+{
+	if(logger->repeats == 0)
+		return;
+
+	char message[64];
+	snprintf(message, sizeof(message), "Last message repeated %u times", logger->repeats);
+	add_log_line(logger, time, logger->lastLevel, message);
+	logger->repeats = 0;
+}
+
+
+/*
+ * adds a message to the batch unless it is the same as the last
+ * one, repeats are only counted until a different message shows
+ * up or LOG_REPEAT_INTERVAL_SECONDS have passed
+ */
+void emit_log_message(Logger* logger, time_t time, unsigned int level, const char* message)
+{
+	if(level == logger->lastLevel && strcmp(message, logger->last) == 0)
+	{
+		if(logger->repeats++ == 0)
+			logger->repeatStart = time;
+		return;
+	}
+
+	flush_log_repeats(logger, time);
+	add_log_line(logger, time, level, message);
+
+	snprintf(logger->last, sizeof(logger->last), "%s", message);
+	logger->lastLevel = level;
+}
+
+
+/*
+ * moves every message in the ring into the batch,
+ * returns the number of messages
+ */
+unsigned int drain_log_ring(Logger* logger)
+{
+	unsigned int count = 0;
+
+	while(1)
+	{
+		LogSlot* slot = &logger->slots[logger->tail & (LOG_RING_SIZE - 1)];
+		if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logger->tail + 1)
+			break;
+
+		emit_log_message(logger, slot->time, slot->level, slot->message);
+
+		//hand the slot back to producers one lap ahead
+		__atomic_store_n(&slot->sequence, logger->tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		logger->tail++;
+		count++;
+	}
+
+	unsigned int dropped = __atomic_exchange_n(&logger->dropped, 0, __ATOMIC_RELAXED);
+	if(dropped > 0)
+	{
+		char message[64];
+		snprintf(message, sizeof(message), "Log buffer was full, %u messages were dropped", dropped);
+		emit_log_message(logger, time(NULL), LOG_LEVEL_WARNING, message);
+	}
+
+	return count;
+}
+
+
+/*
+ * the writer thread, drains the ring every LOG_FLUSH_INTERVAL_NS
+ * until it is stopped and nothing is left
+ */
+void* logger_thread(void* arg)
+{
+	Logger* logger = (Logger*) arg;
+	struct timespec interval = {0, LOG_FLUSH_INTERVAL_NS};
+
+	while(1)
+	{
+		unsigned int stopping = __atomic_load_n(&logger->stopping, __ATOMIC_ACQUIRE);
+		drain_log_ring(logger);
+
+		time_t now = time(NULL);
+		if(logger->repeats > 0 && now - logger->repeatStart >= LOG_REPEAT_INTERVAL_SECONDS)
+			flush_log_repeats(logger, now);
+
+		flush_log_batch(logger);
+
+		if(stopping)
+			break;
+
+		nanosleep(&interval, NULL);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * writes whatever is still queued and stops the writer thread,
+ * from then on messages are written right away
+ */
+void stop_logger()
+{
+	Logger* logger = &_logger;
+
+	if(logger->running == 0)
+		return;
+
+	__atomic_store_n(&logger->stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(logger->thread, NULL);
+	logger->running = 0;
+
+	flush_log_repeats(logger, time(NULL));
+	flush_log_batch(logger);
+}
+
+
+/*
+ * starts the writer thread, until then and if it fails to start
+ * every message is written right away by the caller,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int start_logger()
+{
+	Logger* logger = &_logger;
+
+	if(logger->running)
+		return 1;
+
+	//each slot starts out free for the producer that claims it first
+	for(unsigned int i = 0; i < LOG_RING_SIZE; i++)
+		logger->slots[i].sequence = i;
+
+	logger->head = 0;
+	logger->tail = 0;
+	logger->stopping = 0;
+	open_log_file(logger);
+
+	if(start_thread(&logger->thread, logger_thread, logger) == 0)
+		return 0;
+
+	logger->running = 1;
+
+	//exit() anywhere still gets the queued messages out
+	static unsigned int registered = 0;
+	if(registered == 0)
+		registered = atexit(stop_logger) == 0;
+
+	return 1;
+}
+
+
+/*
+ * queues a message made of message1 followed by message2, which may be
+ * NULL, without taking a lock, a full ring drops the message and the
+ * writer thread reports how many were lost,
+ * returns 1 on successful write, 0 on unsuccessful write
+ */
+unsigned int log_message(unsigned int level, char* message1, char* message2)
+{
+	if(message1 == NULL)
+		return 0;
+
+	Logger* logger = &_logger;
+	if(level < __atomic_load_n(&logger->minLevel, __ATOMIC_RELAXED))
+		return 1;
+
+	if(message2 == NULL)
+		message2 = "";
+
+	//before the writer thread runs there is only the main thread
+	if(logger->running == 0)
+	{
+		char message[LOG_MESSAGE_SIZE];
+		snprintf(message, sizeof(message), "%s%s", message1, message2);
+		emit_log_message(logger, time(NULL), level, message);
+		return flush_log_batch(logger);
+	}
+
+	//claim a slot, a slot whose sequence lags behind is still being read
+	unsigned int head = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+	LogSlot* slot;
+
+	while(1)
+	{
+		slot = &logger->slots[head & (LOG_RING_SIZE - 1)];
+		int lag = (int) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - head);
+
+		if(lag == 0 && __atomic_compare_exchange_n(&logger->head, &head, head + 1, 1,
+												   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+
+		if(lag < 0)
+		{
+			__atomic_fetch_add(&logger->dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+
+		if(lag > 0)
+			head = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+	}
+
+	slot->level = level;
+	slot->time = time(NULL);
+	snprintf(slot->message, sizeof(slot->message), "%s%s", message1, message2);
+
+	//publish the slot to the writer thread
+	__atomic_store_n(&slot->sequence, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
 /*
  * this function writes input to "log.txt"
  * if "log.txt" does not exist then it creates it
@@ -6,26 +431,7 @@
  */
 unsigned int write_log(char* message)
 {
-	//check for null message
-	if(message == NULL)
-		return 0;
-	
-	//ensure file handle
-	FILE* log = fopen("log.txt", "a");
-	
-	if(log == NULL)
-		return 0;
-	
-	char* currentTime = get_current_time();
-	
-	//output message into terminal
-	printf("[%s] Speakeasy-LOG: %s\n", currentTime, message);
-	
-	//if file handle, write and close
-	fprintf(log, "[%s] Speakeasy-LOG: %s\n", currentTime, message);
-	fclose(log);
-	
-	return 1;
+	return log_message(LOG_LEVEL_INFO, message, NULL);
 }
 
 
@@ -37,8 +443,30 @@ unsigned int write_log(char* message)
  */
 unsigned int write_log_two(char* message1, char* message2)
 {
-	char* message = concat_dyn(message1, message2);
-	unsigned int status = write_log(message);
-	free(message);
-	return status;
-}
\ No newline at end of file
+	return log_message(LOG_LEVEL_INFO, message1, message2);
+}
+
+
+/*
+ * these write a message at a level other than info,
+ * the _two versions take two inputs like write_log_two
+ */
+unsigned int write_debug_two(char* message1, char* message2)
+{
+	return log_message(LOG_LEVEL_DEBUG, message1, message2);
+}
+
+unsigned int write_warning(char* message)
+{
+	return log_message(LOG_LEVEL_WARNING, message, NULL);
+}
+
+unsigned int write_error(char* message)
+{
+	return log_message(LOG_LEVEL_ERROR, message, NULL);
+}
+
+unsigned int write_error_two(char* message1, char* message2)
+{
+	return log_message(LOG_LEVEL_ERROR, message1, message2);
+}
@@ -0,0 +1,394 @@
+//tag that marks the lines written by speakeasy's LOG rules
+#define LOG_READER_TAG "Speakeasy-log"
+
+//how much of the log is read at once, reads end on a block boundary
+#define LOG_READER_CHUNK_SIZE (256 * 1024)
+#define LOG_READER_BLOCK_SIZE 4096
+
+//where the position in the log is kept across restarts
+#define LOG_READER_STATE_FILE "logstate.txt"
+#define LOG_READER_STATE_INTERVAL_NS NS_PER_SECOND
+
+/*
+ * what check_log_file found out about the file at the log path:
+ * 	-LOG_FILE_UNCHANGED it is still the file being read
+ * 	-LOG_FILE_ROTATED it was replaced by a different file
+ * 	-LOG_FILE_TRUNCATED it shrank below what was already read
+ */
+#define LOG_FILE_UNCHANGED 0
+#define LOG_FILE_ROTATED 1
+#define LOG_FILE_TRUNCATED 2
+
+
+/*
+ * a line inside the reader's buffer, it always ends with a newline
+ * and stays valid until the reader reads again
+ */
+typedef struct
+{
+	const char* data;
+	size_t length;
+} LineView;
+
+
+/*
+ * this struct houses the state of reading the log:
+ * 	-device and inode identify the file fd refers to
+ * 	-offset is the file offset of the byte after the buffered data,
+ * 	 only what was appended beyond it gets read
+ * 	-length bytes of buffer are filled, everything before start has
+ * 	 been scanned, a partially written last line stays buffered
+ * 	 until the rest of it shows up
+ * 	-savedOffset and savedNs tell when the state file was last written
+ */
+typedef struct
+{
+	int fd;
+	dev_t device;
+	ino_t inode;
+	off_t offset;
+	char* buffer;
+	size_t capacity;
+	size_t length;
+	size_t start;
+	off_t savedOffset;
+	uint64_t savedNs;
+} LogReader;
+
+
+/*
+ * points a reader at a file descriptor and forgets whatever was buffered,
+ * reading starts at offset
+ */
+void reset_log_reader(LogReader* reader, int fd, off_t offset)
+{
+	if(reader == NULL)
+		return;
+
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) == -1)
+		memset(&st, 0, sizeof(st));
+
+	reader->fd = fd;
+	reader->device = st.st_dev;
+	reader->inode = st.st_ino;
+	reader->offset = offset;
+	reader->length = 0;
+	reader->start = 0;
+	reader->savedOffset = -1;
+}
+
+
+/*
+ * allocates the chunk buffer of a log reader and starts it at the
+ * current end of the file so only new entries are read,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must free reader with free_log_reader
+ */
+unsigned int initialize_log_reader(LogReader* reader, int fd)
+{
+	if(reader == NULL)
+		return 0;
+
+	struct stat st;
+	void* buffer = NULL;
+
+	if(fstat(fd, &st) == -1 || posix_memalign(&buffer, LOG_READER_BLOCK_SIZE, LOG_READER_CHUNK_SIZE) != 0)
+		return 0;
+
+	reader->buffer = (char*) buffer;
+	reader->capacity = LOG_READER_CHUNK_SIZE;
+	reset_log_reader(reader, fd, st.st_size);
+	return 1;
+}
+
+
+/*
+ * reads the next part of what was appended to the file into the
+ * free space of the buffer, the read stops on a block boundary of
+ * the file so later reads stay aligned
+ * returns the number of bytes read, 0 at end of file or -1 on error
+ */
+ssize_t log_reader_fill(LogReader* reader)
+{
+	//drop what was scanned, only a partial line is left over
+	memmove(reader->buffer, reader->buffer + reader->start, reader->length - reader->start);
+	reader->length -= reader->start;
+	reader->start = 0;
+
+	size_t space = reader->capacity - reader->length;
+	size_t unaligned = (reader->offset + space) % LOG_READER_BLOCK_SIZE;
+	if(space > unaligned)
+		space -= unaligned;
+
+	ssize_t bytesRead;
+	do
+		bytesRead = pread(reader->fd, reader->buffer + reader->length, space, reader->offset);
+	while(bytesRead == -1 && errno == EINTR);
+
+	if(bytesRead <= 0)
+		return bytesRead;
+
+	reader->length += bytesRead;
+	reader->offset += bytesRead;
+	metric_add(METRIC_LOG_BYTES_READ, bytesRead);
+	return bytesRead;
+}
+
+
+/*
+ * finds the next complete line holding the tag in the buffered data
+ * and points line at it, returns 1 if there was one otherwise 0, in
+ * which case only a partial last line is left unscanned
+ */
+unsigned int log_reader_next_tagged_line(LogReader* reader, LineView* line)
+{
+	const char* buffer = reader->buffer;
+	const char* end = buffer + reader->length;
+	const char* cursor = buffer + reader->start;
+	size_t tagLen = strlen(LOG_READER_TAG);
+
+	const char* hit = tag_scan(cursor, end - cursor, LOG_READER_TAG, tagLen);
+	const char* lineEnd = (hit != NULL) ? memchr(hit, '\n', end - hit) : NULL;
+
+	if(lineEnd != NULL)
+	{
+		//start is always at the start of a line so the search back stops there
+		const char* lineStart = hit;
+		while(lineStart > cursor && lineStart[-1] != '\n')
+			lineStart--;
+
+		line->data = lineStart;
+		line->length = lineEnd + 1 - lineStart;
+		reader->start = lineEnd + 1 - buffer;
+		return 1;
+	}
+
+	//keep the unfinished last line, a tag may be split across reads
+	const char* keep = (hit != NULL) ? hit : end;
+	while(keep > cursor && keep[-1] != '\n')
+		keep--;
+
+	reader->start = keep - buffer;
+
+	//a line longer than the whole buffer can't be a knock
+	if(reader->start == 0 && reader->length == reader->capacity)
+		reader->start = reader->length;
+
+	return 0;
+}
+
+
+/*
+ * reads everything that was appended to the log since the last call
+ * and hands every tagged line to handler as a LogEntry, lines are
+ * parsed where they sit in the buffer
+ * returns the number of entries or -1 on a read error
+ */
+int read_log_entries(LogReader* reader, void (*handler)(LogEntry*))
+{
+	if(reader == NULL || reader->buffer == NULL || handler == NULL)
+		return -1;
+
+	int entries = 0;
+	LineView line;
+	ssize_t bytesRead;
+
+	while((bytesRead = log_reader_fill(reader)) > 0)
+	{
+		while(log_reader_next_tagged_line(reader, &line))
+		{
+			metric_add(METRIC_TAGGED_LINES, 1);
+			
+			LogEntry log;
+			uint64_t startNs = monotonic_ns();
+			unsigned int parsed = construct_log(line.data, &log);
+			metric_observe(METRIC_PARSE_SECONDS, startNs);
+			
+			if(parsed)
+			{
+				metric_add(METRIC_ENTRIES_PARSED, 1);
+				handler(&log);
+				entries++;
+			}
+		}
+	}
+
+	return (bytesRead == -1) ? -1 : entries;
+}
+
+
+/*
+ * returns the offset up to which the log has been handled, a partial
+ * line that is still buffered has to be read again after a restart
+ */
+off_t log_reader_position(LogReader* reader)
+{
+	return reader->offset - (off_t) (reader->length - reader->start);
+}
+
+
+/*
+ * compares the file being read with the one at path, a missing file
+ * counts as unchanged since the new one may not have been created yet
+ * returns LOG_FILE_UNCHANGED, LOG_FILE_ROTATED or LOG_FILE_TRUNCATED
+ */
+int check_log_file(LogReader* reader, char* path)
+{
+	struct stat st;
+
+	if(reader == NULL || path == NULL || stat(path, &st) == -1)
+		return LOG_FILE_UNCHANGED;
+
+	if(st.st_dev != reader->device || st.st_ino != reader->inode)
+		return LOG_FILE_ROTATED;
+
+	if(st.st_size < log_reader_position(reader))
+		return LOG_FILE_TRUNCATED;
+
+	return LOG_FILE_UNCHANGED;
+}
+
+
+/*
+ * writes the file identity and position of a reader to the state
+ * file, the file is replaced in one rename so it is never half written
+ * returns 1 if successful otherwise 0
+ */
+unsigned int save_log_reader_state(LogReader* reader, const char* path)
+{
+	if(reader == NULL || path == NULL || reader->fd == -1)
+		return 0;
+
+	char tmpPath[PATH_MAX];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+	FILE* fptr = fopen(tmpPath, "w");
+	if(fptr == NULL)
+		return 0;
+
+	off_t position = log_reader_position(reader);
+	int written = fprintf(fptr, "device=%llu\ninode=%llu\noffset=%lld\n",
+						  (unsigned long long) reader->device, (unsigned long long) reader->inode,
+						  (long long) position);
+
+	if(fclose(fptr) != 0 || written < 0 || rename(tmpPath, path) == -1)
+	{
+		unlink(tmpPath);
+		return 0;
+	}
+
+	reader->savedOffset = position;
+	reader->savedNs = monotonic_ns();
+	return 1;
+}
+
+
+/*
+ * saves the state of a reader if its position moved, at most
+ * once every LOG_READER_STATE_INTERVAL_NS
+ */
+void save_log_reader_state_throttled(LogReader* reader, const char* path)
+{
+	if(reader == NULL || log_reader_position(reader) == reader->savedOffset)
+		return;
+
+	if(monotonic_ns() - reader->savedNs < LOG_READER_STATE_INTERVAL_NS)
+		return;
+
+	if(save_log_reader_state(reader, path) == 0)
+		write_error("Failed to save log position to " LOG_READER_STATE_FILE);
+}
+
+
+/*
+ * reads the file identity and position saved in the state file,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int load_log_reader_state(const char* path, dev_t* device, ino_t* inode, off_t* offset)
+{
+	FILE* fptr = read_file(path);
+	if(fptr == NULL)
+		return 0;
+
+	unsigned long long savedDevice, savedInode;
+	long long savedOffset;
+	int matched = fscanf(fptr, "device=%llu inode=%llu offset=%lld", &savedDevice, &savedInode, &savedOffset);
+	fclose(fptr);
+
+	if(matched != 3 || savedOffset < 0)
+		return 0;
+
+	*device = savedDevice;
+	*inode = savedInode;
+	*offset = savedOffset;
+	return 1;
+}
+
+
+/*
+ * positions a freshly initialized reader where the last run stopped:
+ * 	-if the saved file is still at path reading resumes at the saved offset
+ * 	-if it was rotated to path.1 meanwhile, the rest of it is read
+ * 	 first and the new file is read from its start
+ * 	-if it can't be found the file at path is read from its start
+ * 	 since all of it was written after the saved position
+ * without a state file the reader stays at the end of the file,
+ * returns 1 if a saved position was used otherwise 0
+ */
+unsigned int resume_log_reader(LogReader* reader, char* path, const char* statePath, void (*handler)(LogEntry*))
+{
+	dev_t device;
+	ino_t inode;
+	off_t offset;
+
+	if(reader == NULL || path == NULL || load_log_reader_state(statePath, &device, &inode, &offset) == 0)
+		return 0;
+
+	int fd = reader->fd;
+	struct stat st;
+
+	if(fstat(fd, &st) == 0 && st.st_dev == device && st.st_ino == inode && st.st_size >= offset)
+	{
+		reset_log_reader(reader, fd, offset);
+		write_log_two("Resuming log from saved position: ", path);
+		return 1;
+	}
+
+	//logrotate's default is to rename the log to path.1
+	char rotatedPath[PATH_MAX];
+	snprintf(rotatedPath, sizeof(rotatedPath), "%s.1", path);
+
+	int rotatedFd = open(rotatedPath, O_RDONLY | O_CLOEXEC);
+	if(rotatedFd != -1)
+	{
+		if(fstat(rotatedFd, &st) == 0 && st.st_dev == device && st.st_ino == inode && st.st_size >= offset)
+		{
+			reset_log_reader(reader, rotatedFd, offset);
+			if(read_log_entries(reader, handler) == -1)
+				write_error_two("Failed to finish reading rotated log: ", rotatedPath);
+			else
+				write_log_two("Finished reading rotated log from saved position: ", rotatedPath);
+		}
+		close(rotatedFd);
+	}
+
+	reset_log_reader(reader, fd, 0);
+	return 1;
+}
+
+
+/*
+ * destroys the chunk buffer of a log reader
+ */
+void free_log_reader(LogReader* reader)
+{
+	if(reader == NULL)
+		return;
+
+	free(reader->buffer);
+	reader->buffer = NULL;
+	reader->capacity = 0;
+	reset_log_reader(reader, -1, 0);
+}
@@ -0,0 +1,273 @@
+/*
+ * the counters kept by every thread, they only ever go up and are
+ * summed over all threads when the metrics are written
+ */
+#define METRIC_LOG_BYTES_READ 0
+#define METRIC_RECORDS_SCANNED 1
+#define METRIC_TAGGED_LINES 2
+#define METRIC_ENTRIES_PARSED 3
+#define METRIC_KNOCKS_MATCHED 4
+#define METRIC_HOSTS_STARTED 5
+#define METRIC_HOSTS_FAILED 6
+#define METRIC_HOSTS_TIMED_OUT 7
+#define METRIC_HOSTS_AUTHENTICATED 8
+#define METRIC_HOSTS_REVOKED 9
+#define METRIC_FIREWALL_OPS_ISSUED 10
+#define METRIC_FIREWALL_OPS_FAILED 11
+#define METRIC_FIREWALL_OPS_RETRIED 12
+#define METRIC_COUNTERS 13
+
+//gauges are set by the main thread right before the metrics are written
+#define METRIC_TRACKED_HOSTS 0
+#define METRIC_WHITELIST_ENTRIES 1
+#define METRIC_FIREWALL_QUEUE 2
+#define METRIC_GAUGES 3
+
+//latency histograms, buckets go up by a factor of 4 from 1 microsecond
+#define METRIC_PARSE_SECONDS 0
+#define METRIC_STATE_UPDATE_SECONDS 1
+#define METRIC_FIREWALL_SECONDS 2
+#define METRIC_HISTOGRAMS 3
+#define METRIC_BUCKETS 12
+#define METRIC_FIRST_BUCKET_NS 1000ULL
+
+//threads past the last one share its counters and may lose counts
+#define METRICS_MAX_THREADS 8
+
+//how often the metrics file is replaced unless config.txt says otherwise
+#define METRICS_DEFAULT_INTERVAL 15
+
+
+/*
+ * the samples of one histogram, buckets[i] counts samples of up to
+ * METRIC_FIRST_BUCKET_NS << 2i, anything slower is only in count
+ */
+typedef struct
+{
+	uint64_t buckets[METRIC_BUCKETS];
+	uint64_t count;
+	uint64_t sumNs;
+} MetricHistogram;
+
+
+/*
+ * the metrics of one thread, only that thread writes them so no
+ * increment needs a locked instruction, the main thread reads them
+ * with relaxed loads, aligned so threads never share a cache line
+ */
+typedef struct
+{
+	uint64_t counters[METRIC_COUNTERS];
+	MetricHistogram histograms[METRIC_HISTOGRAMS];
+} __attribute__((aligned(64))) MetricsShard;
+
+
+MetricsShard _metrics_shards[METRICS_MAX_THREADS];
+unsigned int _metrics_num_shards = 0;
+uint64_t _metrics_gauges[METRIC_GAUGES];
+__thread MetricsShard* _metrics_local = NULL;
+
+
+/*
+ * names, types and help text in the order of the defines above
+ */
+const char* _metric_counter_names[METRIC_COUNTERS][2] =
+{
+	{"speakeasy_log_bytes_read_total", "Bytes read from the syslog file."},
+	{"speakeasy_records_scanned_total", "Journal entries and packets looked at for knocks."},
+	{"speakeasy_tagged_lines_total", "Log lines and packets carrying the speakeasy tag."},
+	{"speakeasy_entries_parsed_total", "Knocks parsed into a log entry."},
+	{"speakeasy_knocks_matched_total", "Knocks that started or advanced a sequence."},
+	{"speakeasy_hosts_started_total", "Hosts that knocked the first port of a sequence."},
+	{"speakeasy_hosts_failed_total", "Hosts that knocked a wrong port."},
+	{"speakeasy_hosts_timed_out_total", "Hosts that didn't finish a sequence in time."},
+	{"speakeasy_hosts_authenticated_total", "Hosts that completed a sequence and were whitelisted."},
+	{"speakeasy_hosts_revoked_total", "Whitelisted hosts that completed a sequence again and were removed."},
+	{"speakeasy_firewall_ops_issued_total", "Firewall changes sent to iptables, ipset or nftables."},
+	{"speakeasy_firewall_ops_failed_total", "Firewall changes that failed to apply."},
+	{"speakeasy_firewall_ops_retried_total", "Failed firewall changes that were queued again."},
+};
+
+const char* _metric_gauge_names[METRIC_GAUGES][2] =
+{
+	{"speakeasy_tracked_hosts", "Hosts in the middle of a knock sequence."},
+	{"speakeasy_whitelist_entries", "Addresses and ranges on the whitelist."},
+	{"speakeasy_firewall_queue_batches", "Firewall batches waiting for the executor."},
+};
+
+const char* _metric_histogram_names[METRIC_HISTOGRAMS][2] =
+{
+	{"speakeasy_parse_seconds", "Time to parse one tagged line or packet."},
+	{"speakeasy_state_update_seconds", "Time to apply one knock to the host table."},
+	{"speakeasy_firewall_seconds", "Time to apply one batch of firewall changes."},
+};
+
+
+/*
+ * returns the metrics of the calling thread, the first
+ * call of a thread claims a shard for it
+ */
+MetricsShard* metrics_shard()
+{
+	if(_metrics_local == NULL)
+	{
+		unsigned int index = __atomic_fetch_add(&_metrics_num_shards, 1, __ATOMIC_RELAXED);
+		if(index >= METRICS_MAX_THREADS)
+			index = METRICS_MAX_THREADS - 1;
+
+		_metrics_local = &_metrics_shards[index];
+	}
+
+	return _metrics_local;
+}
+
+
+/*
+ * adds to a value only the calling thread writes
+ */
+void metric_bump(uint64_t* value, uint64_t amount)
+{
+	__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * adds amount to one of the METRIC counters
+ */
+void metric_add(unsigned int counter, uint64_t amount)
+{
+	metric_bump(&metrics_shard()->counters[counter], amount);
+}
+
+
+/*
+ * records a duration in one of the METRIC histograms, startNs
+ * is when it began on the monotonic_ns clock
+ */
+void metric_observe(unsigned int histogram, uint64_t startNs)
+{
+	uint64_t elapsed = monotonic_ns() - startNs;
+	MetricHistogram* hist = &metrics_shard()->histograms[histogram];
+
+	unsigned int bucket = 0;
+	uint64_t bound = METRIC_FIRST_BUCKET_NS;
+	while(bucket < METRIC_BUCKETS && elapsed > bound)
+	{
+		bucket++;
+		bound <<= 2;
+	}
+
+	//count goes first so a reader never sees more in the buckets than in count
+	metric_bump(&hist->count, 1);
+	metric_bump(&hist->sumNs, elapsed);
+
+	if(bucket < METRIC_BUCKETS)
+		metric_bump(&hist->buckets[bucket], 1);
+}
+
+
+/*
+ * sets one of the METRIC gauges
+ */
+void metric_set(unsigned int gauge, uint64_t value)
+{
+	_metrics_gauges[gauge] = value;
+}
+
+
+/*
+ * returns a counter summed over every thread
+ */
+uint64_t metric_total(unsigned int counter)
+{
+	uint64_t total = 0;
+	for(unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+		total += __atomic_load_n(&_metrics_shards[i].counters[counter], __ATOMIC_RELAXED);
+	return total;
+}
+
+
+/*
+ * writes one histogram summed over every thread in the prometheus
+ * text format, buckets there count every sample up to their bound
+ */
+void write_metric_histogram(FILE* fptr, unsigned int histogram)
+{
+	const char* name = _metric_histogram_names[histogram][0];
+	fprintf(fptr, "# HELP %s %s\n# TYPE %s histogram\n", name, _metric_histogram_names[histogram][1], name);
+
+	uint64_t cumulative = 0;
+	uint64_t bound = METRIC_FIRST_BUCKET_NS;
+
+	for(unsigned int b = 0; b < METRIC_BUCKETS; b++, bound <<= 2)
+	{
+		for(unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+			cumulative += __atomic_load_n(&_metrics_shards[i].histograms[histogram].buckets[b], __ATOMIC_RELAXED);
+
+		fprintf(fptr, "%s_bucket{le=\"%.9g\"} %llu\n", name, bound / 1e9, (unsigned long long) cumulative);
+	}
+
+	uint64_t count = 0, sumNs = 0;
+	for(unsigned int i = 0; i < METRICS_MAX_THREADS; i++)
+	{
+		count += __atomic_load_n(&_metrics_shards[i].histograms[histogram].count, __ATOMIC_RELAXED);
+		sumNs += __atomic_load_n(&_metrics_shards[i].histograms[histogram].sumNs, __ATOMIC_RELAXED);
+	}
+
+	fprintf(fptr, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) count);
+	fprintf(fptr, "%s_sum %.9f\n", name, sumNs / 1e9);
+	fprintf(fptr, "%s_count %llu\n", name, (unsigned long long) count);
+}
+
+
+/*
+ * writes every metric to fptr in the prometheus text format
+ */
+void write_metrics(FILE* fptr)
+{
+	for(unsigned int i = 0; i < METRIC_COUNTERS; i++)
+	{
+		const char* name = _metric_counter_names[i][0];
+		fprintf(fptr, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, _metric_counter_names[i][1],
+				name, name, (unsigned long long) metric_total(i));
+	}
+
+	for(unsigned int i = 0; i < METRIC_GAUGES; i++)
+	{
+		const char* name = _metric_gauge_names[i][0];
+		fprintf(fptr, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, _metric_gauge_names[i][1],
+				name, name, (unsigned long long) _metrics_gauges[i]);
+	}
+
+	for(unsigned int i = 0; i < METRIC_HISTOGRAMS; i++)
+		write_metric_histogram(fptr, i);
+}
+
+
+/*
+ * writes every metric to path in the prometheus text format, the file
+ * is replaced in one rename so a collector never reads half of it,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int write_metrics_file(const char* path)
+{
+	char tmpPath[PATH_MAX];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+	FILE* fptr = fopen(tmpPath, "w");
+	if(fptr == NULL)
+		return 0;
+
+	write_metrics(fptr);
+
+	unsigned int failed = ferror(fptr) != 0;
+	failed |= fclose(fptr) != 0;
+
+	if(failed || rename(tmpPath, path) == -1)
+	{
+		unlink(tmpPath);
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * kernel side batching of NFLOG messages: packets are queued until
+ * NFLOG_QUEUE_THRESHOLD of them are waiting or NFLOG_FLUSH_TIMEOUT
+ * (hundredths of a second) passes, whichever comes first
+ */
+#define NFLOG_QUEUE_THRESHOLD 32
+#define NFLOG_FLUSH_TIMEOUT 5
+
+//only the ip and tcp headers are needed from each packet
+#define NFLOG_COPY_RANGE 64
+#define NFLOG_BUFFER_SIZE 65536
+#define NFLOG_SOCKET_BUFFER 1048576
+#define NFLOG_PREFIX "Speakeasy-log"
+
+
+/*
+ * appends a netlink attribute to the end of msg,
+ * returns 1 if it fit inside maxLen bytes, otherwise 0
+ */
+unsigned int nflog_put_attr(struct nlmsghdr* msg, size_t maxLen, unsigned short type,
+							const void* data, unsigned short dataLen)
+{
+	size_t attrLen = NLA_HDRLEN + dataLen;
+
+	if(NLMSG_ALIGN(msg->nlmsg_len) + NLA_ALIGN(attrLen) > maxLen)
+		return 0;
+
+	struct nlattr* attr = (struct nlattr*) ((char*) msg + NLMSG_ALIGN(msg->nlmsg_len));
+	attr->nla_type = type;
+	attr->nla_len = attrLen;
+	memcpy((char*) attr + NLA_HDRLEN, data, dataLen);
+
+	msg->nlmsg_len = NLMSG_ALIGN(msg->nlmsg_len) + NLA_ALIGN(attrLen);
+	return 1;
+}
+
+
+/*
+ * sends a single NFULNL_MSG_CONFIG message carrying one attribute
+ * and waits for the kernel to acknowledge it, returns 1 if the kernel
+ * accepted the message, otherwise 0
+ */
+unsigned int nflog_send_config(int fd, unsigned char family, unsigned int group,
+							   unsigned short attrType, const void* data, unsigned short dataLen)
+{
+	char buffer[256] __attribute__((aligned(NLMSG_ALIGNTO)));
+	memset(buffer, 0, sizeof(buffer));
+
+	struct nlmsghdr* msg = (struct nlmsghdr*) buffer;
+	msg->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+	msg->nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
+	msg->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+
+	struct nfgenmsg* nfg = (struct nfgenmsg*) NLMSG_DATA(msg);
+	nfg->nfgen_family = family;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(group);
+
+	if(nflog_put_attr(msg, sizeof(buffer), attrType, data, dataLen) == 0)
+		return 0;
+
+	if(send(fd, msg, msg->nlmsg_len, 0) < 0)
+		return 0;
+
+	//wait for the ack which is an error message with error set to 0
+	ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+	if(len < (ssize_t) NLMSG_LENGTH(sizeof(struct nlmsgerr)))
+		return 0;
+
+	if(msg->nlmsg_type != NLMSG_ERROR)
+		return 0;
+
+	struct nlmsgerr* err = (struct nlmsgerr*) NLMSG_DATA(msg);
+	return err->error == 0;
+}
+
+
+/*
+ * opens a netfilter netlink socket bound to an NFLOG group
+ * and configures kernel side batching, returns the
+ * socket or -1 on failure
+ *
+ * side effect: must close returned socket
+ */
+int open_nflog_socket(unsigned int group)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+	if(fd == -1)
+	{
+		write_error("Failed to open netfilter netlink socket");
+		return -1;
+	}
+
+	struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+	if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		write_error("Failed to bind netfilter netlink socket");
+		close(fd);
+		return -1;
+	}
+
+	//a bigger receive buffer absorbs bursts from scanners
+	int rcvBuf = NFLOG_SOCKET_BUFFER;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+
+	//older kernels need the address family bound first, newer ones ignore it
+	struct nfulnl_msg_config_cmd cmd = {.command = NFULNL_CFG_CMD_PF_BIND};
+	nflog_send_config(fd, AF_INET, 0, NFULA_CFG_CMD, &cmd, sizeof(cmd));
+
+	//bind to the group used by the NFLOG rules
+	cmd.command = NFULNL_CFG_CMD_BIND;
+	if(nflog_send_config(fd, AF_UNSPEC, group, NFULA_CFG_CMD, &cmd, sizeof(cmd)) == 0)
+	{
+		write_error("Failed to bind to nflog group, is another program using it?");
+		close(fd);
+		return -1;
+	}
+
+	//copy just enough of each packet to read the headers
+	struct nfulnl_msg_config_mode mode = {.copy_range = htonl(NFLOG_COPY_RANGE),
+										  .copy_mode = NFULNL_COPY_PACKET};
+
+	uint32_t threshold = htonl(NFLOG_QUEUE_THRESHOLD);
+	uint32_t timeout = htonl(NFLOG_FLUSH_TIMEOUT);
+
+	unsigned int configured = nflog_send_config(fd, AF_UNSPEC, group, NFULA_CFG_MODE, &mode, sizeof(mode));
+	configured &= nflog_send_config(fd, AF_UNSPEC, group, NFULA_CFG_QTHRESH, &threshold, sizeof(threshold));
+	configured &= nflog_send_config(fd, AF_UNSPEC, group, NFULA_CFG_TIMEOUT, &timeout, sizeof(timeout));
+
+	if(configured == 0)
+		write_error("Failed to configure nflog batching, using kernel defaults");
+
+	//from here on the socket is only read when poll says so
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+
+/*
+ * reads every batch of packets currently queued on the nflog socket
+ * and hands each one to handler as a LogEntry, returns the number
+ * of entries handled or -1 if the socket failed
+ */
+int read_nflog_entries(int fd, void (*handler)(LogEntry*))
+{
+	static char buffer[NFLOG_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	int handled = 0;
+
+	while(1)
+	{
+		ssize_t len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+		if(len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return handled;
+
+		//the kernel dropped messages, there's nothing to recover so move on
+		if(len == -1 && errno == ENOBUFS)
+		{
+			write_warning("Nflog socket overran, some knocks were dropped");
+			continue;
+		}
+
+		if(len <= 0)
+			return -1;
+
+		int remaining = len;
+		for(struct nlmsghdr* msg = (struct nlmsghdr*) buffer; NLMSG_OK(msg, remaining);
+			msg = NLMSG_NEXT(msg, remaining))
+		{
+			if(msg->nlmsg_type != ((NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET))
+				continue;
+
+			const unsigned char* payload = NULL;
+			size_t payloadLen = 0;
+			unsigned int tagged = 0;
+			metric_add(METRIC_RECORDS_SCANNED, 1);
+
+			//walk the attributes following the nfgenmsg header
+			int attrRemaining = msg->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg));
+			struct nlattr* attr = (struct nlattr*) ((char*) NLMSG_DATA(msg) + NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+
+			while(attrRemaining >= (int) NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= attrRemaining)
+			{
+				const unsigned char* data = (const unsigned char*) attr + NLA_HDRLEN;
+				size_t dataLen = attr->nla_len - NLA_HDRLEN;
+
+				switch(attr->nla_type & NLA_TYPE_MASK)
+				{
+					case NFULA_PAYLOAD:
+						payload = data;
+						payloadLen = dataLen;
+						break;
+					case NFULA_PREFIX:
+						tagged = strncmp((const char*) data, NFLOG_PREFIX, dataLen) == 0;
+						break;
+				}
+
+				attrRemaining -= NLA_ALIGN(attr->nla_len);
+				attr = (struct nlattr*) ((char*) attr + NLA_ALIGN(attr->nla_len));
+			}
+
+			//ignore packets other programs send to the same group
+			if(!tagged)
+				continue;
+			
+			metric_add(METRIC_TAGGED_LINES, 1);
+			
+			LogEntry log;
+			uint64_t startNs = monotonic_ns();
+			unsigned int parsed = construct_log_from_packet(payload, payloadLen, &log);
+			metric_observe(METRIC_PARSE_SECONDS, startNs);
+			
+			if(parsed)
+			{
+				metric_add(METRIC_ENTRIES_PARSED, 1);
+				handler(&log);
+				handled++;
+			}
+		}
+	}
+}
@@ -0,0 +1,875 @@
+/*
+ * names of everything speakeasy owns inside nf_tables, the whole
+ * ruleset lives in one table so it never touches anybody else's rules
+ */
+#define NFT_TABLE_NAME "speakeasy"
+#define NFT_CHAIN_NAME "input"
+#define NFT_ALLOWED_SET "allowed"
+#define NFT_ALLOWED_NET_SET "allowed_nets"
+#define NFT_KNOCKING_SET "knocking"
+
+//nft's datatype number for ipv4_addr
+#define NFT_TYPE_IPV4_ADDR 7
+
+//extra seconds the kernel keeps knocking hosts so speakeasy expires them first
+#define NFT_KNOCK_TIMEOUT_SLACK 2
+
+#define NFT_SOCKET_BUFFER 1048576
+#define NFT_RECEIVE_BUFFER 65536
+
+
+/*
+ * a growable buffer netlink messages are serialized into, offsets
+ * are used instead of pointers since the buffer can move when it grows
+ */
+typedef struct
+{
+	char* data;
+	size_t len;
+	size_t cap;
+	size_t msgStart;
+	uint32_t firstSeq;
+	uint32_t seq;
+	unsigned int numMessages;
+} NftBuffer;
+
+
+/*
+ * a single change to one of the sets, deletes and adds of the same
+ * element cancel out like they do in the iptables batch
+ */
+typedef struct
+{
+	char action;
+	char set[16];
+	uint32_t addr;
+	uint32_t prefixLen;
+	uint64_t timeoutMs;
+} NftElemOp;
+
+
+/*
+ * this struct collects the set changes of one processing pass
+ * so they can be sent as a single nf_tables transaction
+ */
+#define NFT_BATCH_SIZE 1024
+
+typedef struct
+{
+	unsigned int active;
+	unsigned int count;
+	NftElemOp ops[NFT_BATCH_SIZE];
+} NftBatch;
+
+NftBatch _nft_batch = {0};
+int _nft_socket = -1;
+uint64_t _nft_knock_timeout_ms = 0;
+
+
+/*
+ * makes sure size more bytes fit into the buffer and returns a zeroed
+ * region for them, returns null if allocation fails
+ */
+void* nft_put(NftBuffer* buf, size_t size)
+{
+	size_t aligned = NLMSG_ALIGN(size);
+
+	if(buf->len + aligned > buf->cap)
+	{
+		size_t cap = (buf->cap == 0) ? 4096 : buf->cap * 2;
+		while(cap < buf->len + aligned)
+			cap *= 2;
+
+		char* data = realloc(buf->data, cap);
+		if(data == NULL)
+			return NULL;
+
+		buf->data = data;
+		buf->cap = cap;
+	}
+
+	void* region = buf->data + buf->len;
+	memset(region, 0, aligned);
+	buf->len += aligned;
+	return region;
+}
+
+
+/*
+ * starts a new netlink message of an nfnetlink subsystem, the batch
+ * begin and end markers use this as well with their own types
+ */
+void nft_msg_begin(NftBuffer* buf, uint16_t type, uint16_t flags, uint16_t resId)
+{
+	buf->msgStart = buf->len;
+
+	struct nlmsghdr* msg = nft_put(buf, NLMSG_HDRLEN);
+	struct nfgenmsg* nfg = nft_put(buf, sizeof(struct nfgenmsg));
+	if(msg == NULL || nfg == NULL)
+		return;
+
+	//nft_put may have moved the buffer, so look the header up again
+	msg = (struct nlmsghdr*) (buf->data + buf->msgStart);
+	msg->nlmsg_type = type;
+	msg->nlmsg_flags = NLM_F_REQUEST | flags;
+	msg->nlmsg_seq = buf->seq++;
+
+	nfg = (struct nfgenmsg*) (buf->data + buf->msgStart + NLMSG_HDRLEN);
+	nfg->nfgen_family = NFPROTO_INET;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(resId);
+}
+
+
+/*
+ * finishes the message started by nft_msg_begin
+ */
+void nft_msg_end(NftBuffer* buf)
+{
+	struct nlmsghdr* msg = (struct nlmsghdr*) (buf->data + buf->msgStart);
+	msg->nlmsg_len = buf->len - buf->msgStart;
+}
+
+
+/*
+ * starts an nf_tables message that is part of the transaction and
+ * asks the kernel to acknowledge it on its own
+ */
+void nft_cmd_begin(NftBuffer* buf, uint16_t type, uint16_t flags)
+{
+	nft_msg_begin(buf, (NFNL_SUBSYS_NFTABLES << 8) | type, flags | NLM_F_ACK, 0);
+	buf->numMessages++;
+}
+
+
+/*
+ * appends an attribute to the current message
+ */
+void nft_attr(NftBuffer* buf, uint16_t type, const void* data, uint16_t len)
+{
+	struct nlattr* attr = nft_put(buf, NLA_HDRLEN + len);
+	if(attr == NULL)
+		return;
+
+	attr->nla_type = type;
+	attr->nla_len = NLA_HDRLEN + len;
+	memcpy((char*) attr + NLA_HDRLEN, data, len);
+}
+
+void nft_attr_str(NftBuffer* buf, uint16_t type, const char* str)
+{
+	nft_attr(buf, type, str, strlen(str) + 1);
+}
+
+void nft_attr_u32(NftBuffer* buf, uint16_t type, uint32_t value)
+{
+	value = htonl(value);
+	nft_attr(buf, type, &value, sizeof(value));
+}
+
+void nft_attr_u64(NftBuffer* buf, uint16_t type, uint64_t value)
+{
+	value = htobe64(value);
+	nft_attr(buf, type, &value, sizeof(value));
+}
+
+
+/*
+ * opens a nested attribute and returns its offset so that
+ * nft_nest_end can fill in its length once it is complete
+ */
+size_t nft_nest_begin(NftBuffer* buf, uint16_t type)
+{
+	size_t offset = buf->len;
+	struct nlattr* attr = nft_put(buf, NLA_HDRLEN);
+	if(attr != NULL)
+		attr->nla_type = type | NLA_F_NESTED;
+	return offset;
+}
+
+void nft_nest_end(NftBuffer* buf, size_t offset)
+{
+	struct nlattr* attr = (struct nlattr*) (buf->data + offset);
+	attr->nla_len = buf->len - offset;
+}
+
+
+/*
+ * expressions are a list element holding a name and nested data,
+ * nft_expr_begin opens both and nft_expr_end closes them
+ */
+size_t nft_expr_begin(NftBuffer* buf, const char* name, size_t* data)
+{
+	size_t elem = nft_nest_begin(buf, NFTA_LIST_ELEM);
+	nft_attr_str(buf, NFTA_EXPR_NAME, name);
+	*data = nft_nest_begin(buf, NFTA_EXPR_DATA);
+	return elem;
+}
+
+void nft_expr_end(NftBuffer* buf, size_t elem, size_t data)
+{
+	nft_nest_end(buf, data);
+	nft_nest_end(buf, elem);
+}
+
+
+/*
+ * loads a meta key (ex. NFT_META_L4PROTO) into register 1
+ */
+void nft_expr_meta(NftBuffer* buf, uint32_t key)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "meta", &data);
+	nft_attr_u32(buf, NFTA_META_KEY, key);
+	nft_attr_u32(buf, NFTA_META_DREG, NFT_REG_1);
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * loads len bytes at offset of a packet header into register 1
+ */
+void nft_expr_payload(NftBuffer* buf, uint32_t base, uint32_t offset, uint32_t len)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "payload", &data);
+	nft_attr_u32(buf, NFTA_PAYLOAD_DREG, NFT_REG_1);
+	nft_attr_u32(buf, NFTA_PAYLOAD_BASE, base);
+	nft_attr_u32(buf, NFTA_PAYLOAD_OFFSET, offset);
+	nft_attr_u32(buf, NFTA_PAYLOAD_LEN, len);
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * stops evaluating the rule unless register 1 equals value
+ */
+void nft_expr_cmp_eq(NftBuffer* buf, const void* value, uint16_t len)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "cmp", &data);
+	nft_attr_u32(buf, NFTA_CMP_SREG, NFT_REG_1);
+	nft_attr_u32(buf, NFTA_CMP_OP, NFT_CMP_EQ);
+	size_t cmpData = nft_nest_begin(buf, NFTA_CMP_DATA);
+	nft_attr(buf, NFTA_DATA_VALUE, value, len);
+	nft_nest_end(buf, cmpData);
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * stops evaluating the rule unless register 1 is in the named set
+ */
+void nft_expr_lookup(NftBuffer* buf, const char* set)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "lookup", &data);
+	nft_attr_str(buf, NFTA_LOOKUP_SET, set);
+	nft_attr_u32(buf, NFTA_LOOKUP_SREG, NFT_REG_1);
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * ends the rule with a verdict such as NF_ACCEPT or NF_DROP
+ */
+void nft_expr_verdict(NftBuffer* buf, uint32_t code)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "immediate", &data);
+	nft_attr_u32(buf, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+	size_t immData = nft_nest_begin(buf, NFTA_IMMEDIATE_DATA);
+	size_t verdict = nft_nest_begin(buf, NFTA_DATA_VERDICT);
+	nft_attr_u32(buf, NFTA_VERDICT_CODE, code);
+	nft_nest_end(buf, verdict);
+	nft_nest_end(buf, immData);
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * rejects the packet with icmp port unreachable like iptables REJECT does
+ */
+void nft_expr_reject(NftBuffer* buf)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "reject", &data);
+	nft_attr_u32(buf, NFTA_REJECT_TYPE, NFT_REJECT_ICMPX_UNREACH);
+	uint8_t code = NFT_REJECT_ICMPX_PORT_UNREACH;
+	nft_attr(buf, NFTA_REJECT_ICMP_CODE, &code, sizeof(code));
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * logs the packet the same way the iptables logging rules do,
+ * to syslog with the speakeasy prefix or to the configured nflog group
+ */
+void nft_expr_log(NftBuffer* buf, Config* cfg)
+{
+	size_t data;
+	size_t elem = nft_expr_begin(buf, "log", &data);
+
+	if(cfg->logBackend == LOG_BACKEND_NFLOG)
+	{
+		uint16_t group = htons(cfg->nflogGroup);
+		nft_attr(buf, NFTA_LOG_GROUP, &group, sizeof(group));
+		nft_attr_str(buf, NFTA_LOG_PREFIX, NFLOG_PREFIX);
+		nft_attr_u32(buf, NFTA_LOG_SNAPLEN, NFLOG_COPY_RANGE);
+	}
+	else
+	{
+		nft_attr_str(buf, NFTA_LOG_PREFIX, "[Speakeasy-log]: ");
+		nft_attr_u32(buf, NFTA_LOG_LEVEL, 4);
+	}
+	nft_expr_end(buf, elem, data);
+}
+
+
+/*
+ * matches tcp packets and loads their destination port into register 1
+ */
+void nft_expr_tcp_dport(NftBuffer* buf)
+{
+	uint8_t tcp = IPPROTO_TCP;
+	nft_expr_meta(buf, NFT_META_L4PROTO);
+	nft_expr_cmp_eq(buf, &tcp, sizeof(tcp));
+	nft_expr_payload(buf, NFT_PAYLOAD_TRANSPORT_HEADER, 2, 2);
+}
+
+
+/*
+ * matches ipv4 packets whose source address is in the named set
+ */
+void nft_expr_saddr_in_set(NftBuffer* buf, const char* set)
+{
+	uint8_t ipv4 = NFPROTO_IPV4;
+	nft_expr_meta(buf, NFT_META_NFPROTO);
+	nft_expr_cmp_eq(buf, &ipv4, sizeof(ipv4));
+	nft_expr_payload(buf, NFT_PAYLOAD_NETWORK_HEADER, 12, 4);
+	nft_expr_lookup(buf, set);
+}
+
+
+/*
+ * a rule is a NEWRULE message appended to the chain whose expressions
+ * are written between nft_rule_begin and nft_rule_end
+ */
+size_t nft_rule_begin(NftBuffer* buf)
+{
+	nft_cmd_begin(buf, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+	nft_attr_str(buf, NFTA_RULE_TABLE, NFT_TABLE_NAME);
+	nft_attr_str(buf, NFTA_RULE_CHAIN, NFT_CHAIN_NAME);
+	return nft_nest_begin(buf, NFTA_RULE_EXPRESSIONS);
+}
+
+void nft_rule_end(NftBuffer* buf, size_t exprs)
+{
+	nft_nest_end(buf, exprs);
+	nft_msg_end(buf);
+}
+
+
+/*
+ * adds a NEWSET message for a set of ipv4 addresses
+ */
+void nft_add_set(NftBuffer* buf, const char* name, uint32_t flags, uint64_t timeoutMs, uint32_t id)
+{
+	nft_cmd_begin(buf, NFT_MSG_NEWSET, NLM_F_CREATE);
+	nft_attr_str(buf, NFTA_SET_TABLE, NFT_TABLE_NAME);
+	nft_attr_str(buf, NFTA_SET_NAME, name);
+	nft_attr_u32(buf, NFTA_SET_FLAGS, flags);
+	nft_attr_u32(buf, NFTA_SET_KEY_TYPE, NFT_TYPE_IPV4_ADDR);
+	nft_attr_u32(buf, NFTA_SET_KEY_LEN, sizeof(uint32_t));
+	nft_attr_u32(buf, NFTA_SET_ID, id);
+	if(timeoutMs > 0)
+		nft_attr_u64(buf, NFTA_SET_TIMEOUT, timeoutMs);
+	nft_msg_end(buf);
+}
+
+
+/*
+ * wraps the messages in buf into a batch, this reserves the begin
+ * marker, nft_batch_end appends the end marker
+ */
+void nft_batch_begin(NftBuffer* buf)
+{
+	memset(buf, 0, sizeof(NftBuffer));
+	buf->seq = time(NULL);
+
+	nft_msg_begin(buf, NFNL_MSG_BATCH_BEGIN, 0, NFNL_SUBSYS_NFTABLES);
+	nft_msg_end(buf);
+	buf->firstSeq = buf->seq;
+}
+
+void nft_batch_end(NftBuffer* buf)
+{
+	nft_msg_begin(buf, NFNL_MSG_BATCH_END, 0, NFNL_SUBSYS_NFTABLES);
+	nft_msg_end(buf);
+}
+
+
+/*
+ * opens the netlink socket used for every transaction,
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int nft_open_socket()
+{
+	if(_nft_socket != -1)
+		return 1;
+
+	_nft_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+	if(_nft_socket == -1)
+		return 0;
+
+	struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+	if(bind(_nft_socket, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		close(_nft_socket);
+		_nft_socket = -1;
+		return 0;
+	}
+
+	//big transactions need room and acks must not block forever
+	int size = NFT_SOCKET_BUFFER;
+	struct timeval timeout = {.tv_sec = 2};
+	setsockopt(_nft_socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(_nft_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(_nft_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return 1;
+}
+
+
+/*
+ * sends a finished batch as one transaction and collects the ack of
+ * every message in it, errors[i] is set to the errno of message i or
+ * 0 if it was accepted, the kernel rolls the whole transaction back if
+ * any message fails, returns the number of failed messages or -1 if
+ * the transaction couldn't be sent or its acks weren't received
+ */
+int nft_send_batch(NftBuffer* buf, int* errors)
+{
+	if(nft_open_socket() == 0 || buf->data == NULL)
+		return -1;
+
+	for(unsigned int i = 0; i < buf->numMessages; i++)
+		errors[i] = 0;
+
+	if(send(_nft_socket, buf->data, buf->len, 0) != (ssize_t) buf->len)
+		return -1;
+
+	static char reply[NFT_RECEIVE_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+	unsigned int acked = 0;
+	int failed = 0;
+
+	while(acked < buf->numMessages)
+	{
+		ssize_t len = recv(_nft_socket, reply, sizeof(reply), 0);
+		if(len <= 0)
+			return -1;
+
+		int remaining = len;
+		for(struct nlmsghdr* msg = (struct nlmsghdr*) reply; NLMSG_OK(msg, remaining);
+			msg = NLMSG_NEXT(msg, remaining))
+		{
+			if(msg->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			struct nlmsgerr* err = (struct nlmsgerr*) NLMSG_DATA(msg);
+			uint32_t index = msg->nlmsg_seq - buf->firstSeq;
+
+			//an error on the batch markers means nothing got through
+			if(index >= buf->numMessages)
+			{
+				for(unsigned int i = 0; i < buf->numMessages; i++)
+					errors[i] = -err->error;
+				return buf->numMessages;
+			}
+
+			errors[index] = -err->error;
+			failed += err->error != 0;
+			acked++;
+		}
+	}
+	return failed;
+}
+
+
+/*
+ * adds the rules of the speakeasy chain for a config to a transaction:
+ * logging of knocking hosts and first ports, accepting whitelisted
+ * hosts and blocking the blacklisted ports for everybody else
+ */
+void nft_add_rules(NftBuffer* buf, Config* cfg)
+{
+	//packet capture reads knocks before the firewall and needs no logging
+	if(cfg->logBackend != LOG_BACKEND_PACKET)
+	{
+		//every tcp packet from a host in the middle of knocking is logged
+		uint8_t tcp = IPPROTO_TCP;
+		size_t exprs = nft_rule_begin(buf);
+		nft_expr_saddr_in_set(buf, NFT_KNOCKING_SET);
+		nft_expr_meta(buf, NFT_META_L4PROTO);
+		nft_expr_cmp_eq(buf, &tcp, sizeof(tcp));
+		nft_expr_log(buf, cfg);
+		nft_rule_end(buf, exprs);
+
+		//as well as the first port of every sequence from anybody
+		for(unsigned int i = 0; i < cfg->knockProgram->numEntryPorts; i++)
+		{
+			uint16_t firstPort = htons(cfg->knockProgram->entryPorts[i]);
+			exprs = nft_rule_begin(buf);
+			nft_expr_tcp_dport(buf);
+			nft_expr_cmp_eq(buf, &firstPort, sizeof(firstPort));
+			nft_expr_log(buf, cfg);
+			nft_rule_end(buf, exprs);
+		}
+	}
+
+	//whitelisted hosts and ranges are accepted
+	const char* allowedSets[] = {NFT_ALLOWED_SET, NFT_ALLOWED_NET_SET};
+	for(unsigned int i = 0; i < 2; i++)
+	{
+		size_t exprs = nft_rule_begin(buf);
+		nft_expr_saddr_in_set(buf, allowedSets[i]);
+		nft_expr_verdict(buf, NF_ACCEPT);
+		nft_rule_end(buf, exprs);
+	}
+
+	//everybody else gets dropped or rejected on the blacklisted ports
+	for(unsigned int i = 0; cfg->blacklistPorts[i] != NULL; i++)
+	{
+		uint16_t port = htons(atoi(cfg->blacklistPorts[i]));
+		if(port == 0)
+			continue;
+
+		size_t exprs = nft_rule_begin(buf);
+		nft_expr_tcp_dport(buf);
+		nft_expr_cmp_eq(buf, &port, sizeof(port));
+
+		if(strcmp(cfg->firewallResponse, "DROP") == 0)
+			nft_expr_verdict(buf, NF_DROP);
+		else
+			nft_expr_reject(buf);
+
+		nft_rule_end(buf, exprs);
+	}
+}
+
+
+/*
+ * sends a finished transaction and reports exactly which messages
+ * the kernel refused, what names the transaction in the log,
+ * returns 1 if the whole transaction was applied, otherwise 0
+ *
+ * side effect: frees the buffer
+ */
+unsigned int nft_send_transaction(NftBuffer* buf, const char* what)
+{
+	int* errors = malloc(sizeof(int) * buf->numMessages);
+	int failed = (errors != NULL) ? nft_send_batch(buf, errors) : -1;
+
+	if(failed == -1)
+	{
+		char message[64];
+		snprintf(message, sizeof(message), "Failed to send nftables %s transaction", what);
+		write_error(message);
+	}
+
+	for(unsigned int i = 0; failed > 0 && i < buf->numMessages; i++)
+	{
+		if(errors[i] != 0)
+		{
+			char message[96];
+			snprintf(message, sizeof(message), "Nftables %s message %u refused: %s", what, i, strerror(errors[i]));
+			write_error(message);
+		}
+	}
+
+	free(errors);
+	free(buf->data);
+	return failed == 0;
+}
+
+
+/*
+ * replaces the speakeasy table with a freshly built one in a single
+ * transaction: the chain, the allowed and knocking sets, the knock
+ * logging rules, the accept rules and the blacklist rules, hosts are
+ * never left without a ruleset in between
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int nft_setup_table(Config* cfg)
+{
+	if(cfg == NULL)
+		return 0;
+
+	NftBuffer buf;
+	nft_batch_begin(&buf);
+
+	//adding the table first makes deleting it safe even if it didn't exist
+	for(unsigned int i = 0; i < 3; i++)
+	{
+		uint16_t type = (i == 1) ? NFT_MSG_DELTABLE : NFT_MSG_NEWTABLE;
+		nft_cmd_begin(&buf, type, (i == 1) ? 0 : NLM_F_CREATE);
+		nft_attr_str(&buf, NFTA_TABLE_NAME, NFT_TABLE_NAME);
+		nft_msg_end(&buf);
+	}
+
+	//base chain on the input hook that accepts by default
+	nft_cmd_begin(&buf, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	nft_attr_str(&buf, NFTA_CHAIN_TABLE, NFT_TABLE_NAME);
+	nft_attr_str(&buf, NFTA_CHAIN_NAME, NFT_CHAIN_NAME);
+	size_t hook = nft_nest_begin(&buf, NFTA_CHAIN_HOOK);
+	nft_attr_u32(&buf, NFTA_HOOK_HOOKNUM, NF_INET_LOCAL_IN);
+	nft_attr_u32(&buf, NFTA_HOOK_PRIORITY, 0);
+	nft_nest_end(&buf, hook);
+	nft_attr_str(&buf, NFTA_CHAIN_TYPE, "filter");
+	nft_attr_u32(&buf, NFTA_CHAIN_POLICY, NF_ACCEPT);
+	nft_msg_end(&buf);
+
+	//knocking hosts expire on their own in case speakeasy doesn't get to them
+	_nft_knock_timeout_ms = (uint64_t) (cfg->timeout + NFT_KNOCK_TIMEOUT_SLACK) * 1000;
+	nft_add_set(&buf, NFT_ALLOWED_SET, 0, 0, 1);
+	nft_add_set(&buf, NFT_ALLOWED_NET_SET, NFT_SET_INTERVAL, 0, 2);
+	nft_add_set(&buf, NFT_KNOCKING_SET, NFT_SET_TIMEOUT, _nft_knock_timeout_ms, 3);
+
+	nft_add_rules(&buf, cfg);
+	nft_batch_end(&buf);
+
+	return nft_send_transaction(&buf, "setup");
+}
+
+
+/*
+ * swaps the rules of the speakeasy chain for those of another config,
+ * the chain is flushed and refilled in one transaction so the kernel
+ * never runs the chain half way through, the sets and the hosts in
+ * them are left alone, returns 1 if successful, otherwise 0
+ */
+unsigned int nft_replace_rules(Config* cfg)
+{
+	if(cfg == NULL)
+		return 0;
+
+	NftBuffer buf;
+	nft_batch_begin(&buf);
+
+	//a rule delete naming only the chain flushes it
+	nft_cmd_begin(&buf, NFT_MSG_DELRULE, 0);
+	nft_attr_str(&buf, NFTA_RULE_TABLE, NFT_TABLE_NAME);
+	nft_attr_str(&buf, NFTA_RULE_CHAIN, NFT_CHAIN_NAME);
+	nft_msg_end(&buf);
+
+	nft_add_rules(&buf, cfg);
+	nft_batch_end(&buf);
+
+	return nft_send_transaction(&buf, "reload");
+}
+
+
+/*
+ * appends a NEWSETELEM or DELSETELEM message for a single element,
+ * entries in the interval set are written as a start and an end key
+ */
+void nft_add_elem_msg(NftBuffer* buf, NftElemOp* op)
+{
+	unsigned int add = op->action != 'D';
+	nft_cmd_begin(buf, add ? NFT_MSG_NEWSETELEM : NFT_MSG_DELSETELEM, add ? NLM_F_CREATE : 0);
+	nft_attr_str(buf, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+	nft_attr_str(buf, NFTA_SET_ELEM_LIST_SET, op->set);
+
+	size_t elems = nft_nest_begin(buf, NFTA_SET_ELEM_LIST_ELEMENTS);
+	uint32_t keys[2] = {op->addr, 0};
+	unsigned int numKeys = 1;
+
+	//intervals are [start, end) so the end key is one past the last address
+	if(op->prefixLen > 0)
+	{
+		uint32_t size = (op->prefixLen == 32) ? 1 : (1u << (32 - op->prefixLen));
+		keys[1] = htonl(ntohl(op->addr) + size);
+		numKeys = (keys[1] == 0) ? 1 : 2;
+	}
+
+	for(unsigned int i = 0; i < numKeys; i++)
+	{
+		size_t elem = nft_nest_begin(buf, NFTA_LIST_ELEM);
+		size_t key = nft_nest_begin(buf, NFTA_SET_ELEM_KEY);
+		nft_attr(buf, NFTA_DATA_VALUE, &keys[i], sizeof(uint32_t));
+		nft_nest_end(buf, key);
+
+		if(i == 1)
+			nft_attr_u32(buf, NFTA_SET_ELEM_FLAGS, NFT_SET_ELEM_INTERVAL_END);
+		if(add && op->timeoutMs > 0)
+			nft_attr_u64(buf, NFTA_SET_ELEM_TIMEOUT, op->timeoutMs);
+
+		nft_nest_end(buf, elem);
+	}
+	nft_nest_end(buf, elems);
+	nft_msg_end(buf);
+}
+
+
+/*
+ * starts collecting set changes instead of sending them,
+ * they are sent by nft_batch_commit
+ */
+void nft_batch_open()
+{
+	_nft_batch.active = 1;
+	_nft_batch.count = 0;
+}
+
+
+/*
+ * sends every queued set change as one transaction, since a single
+ * refused message rolls the transaction back the changes the kernel
+ * accepted are sent again without the refused ones, deleting an element
+ * that already timed out or adding a range that's already covered isn't
+ * treated as a failure
+ * returns 1 if everything was applied, otherwise 0
+ */
+unsigned int nft_batch_commit()
+{
+	NftBatch* batch = &_nft_batch;
+	batch->active = 0;
+
+	if(batch->count == 0)
+		return 1;
+
+	uint64_t startNs = monotonic_ns();
+	metric_add(METRIC_FIREWALL_OPS_ISSUED, batch->count);
+
+	unsigned int pending[NFT_BATCH_SIZE];
+	unsigned int numPending = batch->count;
+	for(unsigned int i = 0; i < numPending; i++)
+		pending[i] = i;
+
+	unsigned int status = 1;
+	int errors[NFT_BATCH_SIZE];
+
+	while(numPending > 0)
+	{
+		NftBuffer buf;
+		nft_batch_begin(&buf);
+		for(unsigned int i = 0; i < numPending; i++)
+			nft_add_elem_msg(&buf, &batch->ops[pending[i]]);
+		nft_batch_end(&buf);
+
+		int failed = nft_send_batch(&buf, errors);
+		free(buf.data);
+
+		if(failed == 0)
+			break;
+
+		if(failed == -1)
+		{
+			write_error("Failed to send nftables transaction");
+			metric_add(METRIC_FIREWALL_OPS_FAILED, numPending);
+			status = 0;
+			break;
+		}
+
+		//keep what was accepted, report the rest
+		unsigned int kept = 0;
+		for(unsigned int i = 0; i < numPending; i++)
+		{
+			NftElemOp* op = &batch->ops[pending[i]];
+
+			if(errors[i] == 0)
+				pending[kept++] = pending[i];
+			else if(errors[i] != ((op->action == 'D') ? ENOENT : EEXIST))
+			{
+				char addr[INET_ADDRSTRLEN];
+				char message[128];
+				inet_ntop(AF_INET, &op->addr, addr, sizeof(addr));
+				snprintf(message, sizeof(message), "Nftables refused to %s %s in set %s: %s",
+						 (op->action == 'D') ? "delete" : "add", addr, op->set, strerror(errors[i]));
+				write_error(message);
+				metric_add(METRIC_FIREWALL_OPS_FAILED, 1);
+				status = 0;
+			}
+		}
+
+		numPending = kept;
+	}
+
+	metric_observe(METRIC_FIREWALL_SECONDS, startNs);
+	batch->count = 0;
+	return status;
+}
+
+
+/*
+ * queues a set change in the open batch or sends it right away
+ * if no batch is open, returns 1 if successful, otherwise 0
+ */
+unsigned int nft_apply_elem(NftElemOp* op)
+{
+	NftBatch* batch = &_nft_batch;
+
+	if(batch->active == 0)
+	{
+		nft_batch_open();
+		batch->ops[batch->count++] = *op;
+		return nft_batch_commit();
+	}
+
+	//an add and a delete of the same element cancel out
+	for(int i = batch->count - 1; i >= 0; i--)
+	{
+		NftElemOp* pending = &batch->ops[i];
+		unsigned int opposite = (op->action == 'D') != (pending->action == 'D');
+
+		if(opposite && pending->addr == op->addr && pending->prefixLen == op->prefixLen &&
+		   strcmp(pending->set, op->set) == 0)
+		{
+			memmove(pending, pending + 1, sizeof(NftElemOp) * (batch->count - i - 1));
+			batch->count--;
+			return 1;
+		}
+	}
+
+	//a full batch is sent early and a new one started
+	if(batch->count == NFT_BATCH_SIZE)
+	{
+		nft_batch_commit();
+		nft_batch_open();
+	}
+
+	batch->ops[batch->count++] = *op;
+	return 1;
+}
+
+
+/*
+ * adds ('A') or deletes ('D') a host or a cidr range in one of the
+ * speakeasy sets, ranges always go to the interval set
+ * returns 1 if successful, otherwise 0
+ */
+unsigned int nft_update_set(char action, const char* set, char* host, uint64_t timeoutMs)
+{
+	if(host == NULL)
+		return 0;
+
+	uint32_t mask;
+	NftElemOp op = {.action = action, .timeoutMs = timeoutMs};
+	snprintf(op.set, sizeof(op.set), "%s", set);
+
+	//ranges are stored by their first address, which the parser masks
+	if(parse_whitelist_entry(host, &op.addr, &mask) == 0)
+		return 0;
+
+	//a range with a prefix length goes to the interval set, a /0 can't
+	//be one since its end would be past the last address
+	if(strchr(host, '/') != NULL)
+	{
+		op.prefixLen = __builtin_popcount(mask);
+		snprintf(op.set, sizeof(op.set), "%s", NFT_ALLOWED_NET_SET);
+
+		if(op.prefixLen == 0)
+			return 0;
+	}
+
+	return nft_apply_elem(&op);
+}
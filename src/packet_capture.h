@@ -0,0 +1,234 @@
+/*
+ * geometry of the TPACKET_V3 receive ring, blocks are handed to
+ * userspace when full or after PACKET_BLOCK_TIMEOUT milliseconds
+ * so a single wakeup can carry many knocks
+ */
+#define PACKET_BLOCK_SIZE (1 << 16)
+#define PACKET_BLOCK_COUNT 16
+#define PACKET_FRAME_SIZE 256
+#define PACKET_BLOCK_TIMEOUT 10
+
+//the filter needs a few instructions per port and jumps are 8 bits
+#define PACKET_MAX_FILTER_PORTS 240
+#define PACKET_SNAP_LENGTH 96
+
+
+/*
+ * this struct houses an AF_PACKET socket and
+ * the memory mapped ring it receives packets into
+ */
+typedef struct
+{
+	int fd;
+	unsigned char* ring;
+	size_t ringSize;
+	unsigned int currentBlock;
+} PacketRing;
+
+
+/*
+ * compiles a classic BPF program that only accepts tcp SYNs
+ * (without ACK) to one of the given distinct ports, the program reads
+ * the network header since the socket is SOCK_DGRAM, returns the
+ * number of instructions or 0 if there are no usable ports
+ */
+unsigned int build_knock_filter(uint16_t* ports, unsigned int numPorts, struct sock_filter* filter)
+{
+	if(ports == NULL || filter == NULL || numPorts == 0 || numPorts > PACKET_MAX_FILTER_PORTS)
+		return 0;
+
+	//layout: 9 header checks, one compare per port, then drop and accept
+	unsigned int drop = 9 + numPorts;
+	unsigned int accept = drop + 1;
+	unsigned int n = 0;
+
+	//tcp only and not a later fragment
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9); n++;
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, drop - n - 1); n++;
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6); n++;
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, drop - n - 1, 0); n++;
+
+	//x = ip header length, then SYN set and ACK clear
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0); n++;
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_IND, 13); n++;
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x12); n++;
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x02, 0, drop - n - 1); n++;
+
+	//destination port against every knock port
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2); n++;
+	for(unsigned int i = 0; i < numPorts; i++)
+	{
+		filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ports[i], accept - n - 1, 0);
+		n++;
+	}
+
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0); n++;
+	filter[n] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, PACKET_SNAP_LENGTH); n++;
+
+	return n;
+}
+
+
+/*
+ * attaches the filter for the ports of every knock sequence to a
+ * packet socket, a filter that was attached before is replaced in
+ * one step and stays if this fails, returns 1 if successful otherwise 0
+ */
+unsigned int attach_knock_filter(int fd, KnockProgram* knockProgram)
+{
+	struct sock_filter filter[PACKET_MAX_FILTER_PORTS + 11];
+	struct sock_fprog program = {.len = build_knock_filter(knockProgram->ports, knockProgram->numPorts, filter),
+								 .filter = filter};
+
+	return program.len != 0 && setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0;
+}
+
+
+/*
+ * opens an AF_PACKET socket filtered down to SYNs on the ports of
+ * every knock sequence and maps a TPACKET_V3 receive ring for it,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must free ring with free_packet_ring
+ */
+unsigned int open_packet_ring(PacketRing* ring, KnockProgram* knockProgram)
+{
+	if(ring == NULL)
+		return 0;
+
+	ring->ring = NULL;
+	ring->currentBlock = 0;
+
+	//protocol 0 so nothing is queued before the filter is attached
+	ring->fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(ring->fd == -1)
+	{
+		write_error("Failed to open packet socket");
+		return 0;
+	}
+
+	if(attach_knock_filter(ring->fd, knockProgram) == 0)
+	{
+		write_error("Failed to attach knock port filter to packet socket, at most 240 distinct knock ports fit");
+		close(ring->fd);
+		return 0;
+	}
+
+	//set up the ring
+	int version = TPACKET_V3;
+	struct tpacket_req3 req = {0};
+	req.tp_block_size = PACKET_BLOCK_SIZE;
+	req.tp_block_nr = PACKET_BLOCK_COUNT;
+	req.tp_frame_size = PACKET_FRAME_SIZE;
+	req.tp_frame_nr = (PACKET_BLOCK_SIZE / PACKET_FRAME_SIZE) * PACKET_BLOCK_COUNT;
+	req.tp_retire_blk_tov = PACKET_BLOCK_TIMEOUT;
+
+	if(setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1 ||
+	   setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+	{
+		write_error("Failed to set up TPACKET_V3 receive ring");
+		close(ring->fd);
+		return 0;
+	}
+
+	ring->ringSize = (size_t) PACKET_BLOCK_SIZE * PACKET_BLOCK_COUNT;
+	ring->ring = mmap(NULL, ring->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if(ring->ring == MAP_FAILED)
+	{
+		write_error("Failed to map packet receive ring");
+		ring->ring = NULL;
+		close(ring->fd);
+		return 0;
+	}
+
+	//only now start receiving ipv4 packets on every interface
+	struct sockaddr_ll addr = {.sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_IP)};
+	if(bind(ring->fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		write_error("Failed to bind packet socket");
+		munmap(ring->ring, ring->ringSize);
+		ring->ring = NULL;
+		close(ring->fd);
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * walks every block the kernel has handed over and gives each
+ * incoming packet to handler as a LogEntry, the packets are read in
+ * place and the blocks returned to the kernel afterwards, returns
+ * the number of entries handled
+ */
+int read_packet_ring(PacketRing* ring, void (*handler)(LogEntry*))
+{
+	if(ring == NULL || ring->ring == NULL)
+		return 0;
+
+	int handled = 0;
+
+	while(1)
+	{
+		struct tpacket_block_desc* block = (struct tpacket_block_desc*)
+			(ring->ring + (size_t) ring->currentBlock * PACKET_BLOCK_SIZE);
+
+		if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+			return handled;
+
+		struct tpacket3_hdr* packet = (struct tpacket3_hdr*)
+			((unsigned char*) block + block->hdr.bh1.offset_to_first_pkt);
+
+		for(unsigned int i = 0; i < block->hdr.bh1.num_pkts; i++)
+		{
+			struct sockaddr_ll* link = (struct sockaddr_ll*)
+				((unsigned char*) packet + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			metric_add(METRIC_RECORDS_SCANNED, 1);
+			
+			//packets this machine sends out are no knocks, the rest were
+			//picked by the socket filter so they all count as tagged
+			if(link->sll_pkttype != PACKET_OUTGOING)
+			{
+				metric_add(METRIC_TAGGED_LINES, 1);
+				
+				LogEntry log;
+				uint64_t startNs = monotonic_ns();
+				unsigned int parsed = construct_log_from_packet((unsigned char*) packet + packet->tp_net,
+																packet->tp_snaplen, &log);
+				metric_observe(METRIC_PARSE_SECONDS, startNs);
+				
+				if(parsed)
+				{
+					metric_add(METRIC_ENTRIES_PARSED, 1);
+					handler(&log);
+					handled++;
+				}
+			}
+			packet = (struct tpacket3_hdr*) ((unsigned char*) packet + packet->tp_next_offset);
+		}
+
+		//give the block back and move to the next one
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		ring->currentBlock = (ring->currentBlock + 1) % PACKET_BLOCK_COUNT;
+	}
+}
+
+
+/*
+ * destroys a packet ring by unmapping it and closing the socket
+ */
+void free_packet_ring(PacketRing* ring)
+{
+	if(ring == NULL)
+		return;
+
+	if(ring->ring != NULL)
+		munmap(ring->ring, ring->ringSize);
+
+	if(ring->fd != -1)
+		close(ring->fd);
+
+	ring->ring = NULL;
+	ring->fd = -1;
+}
@@ -0,0 +1,241 @@
+//most arguments a firewall command is split into
+#define PROCESS_MAX_ARGS 64
+
+//handed to every child as is
+extern char** environ;
+
+
+/*
+ * splits a command line into argv in place, words are separated by
+ * whitespace and a double quoted part ex. "[Speakeasy-log]: " stays
+ * one word without its quotes, no other shell syntax has a meaning,
+ * argv is NULL terminated so it holds at most maxArgs - 1 words,
+ * returns the number of words or -1 if there are too many
+ * or a quote isn't closed
+ */
+int split_arguments(char* line, char** argv, unsigned int maxArgs)
+{
+	unsigned int argc = 0;
+	char* read = line;
+
+	while(1)
+	{
+		while(*read == ' ' || *read == '\t' || *read == '\n')
+			read++;
+
+		if(*read == '\0')
+			break;
+
+		if(argc + 1 >= maxArgs)
+			return -1;
+
+		//the word is copied down over its own quotes as it is read
+		char* write = read;
+		argv[argc++] = write;
+		unsigned int quoted = 0;
+
+		for(; *read != '\0' && (quoted || (*read != ' ' && *read != '\t' && *read != '\n')); read++)
+		{
+			if(*read == '"')
+				quoted = !quoted;
+			else
+				*write++ = *read;
+		}
+
+		if(quoted)
+			return -1;
+
+		//the separator is overwritten, so step past it first
+		unsigned int end = *read == '\0';
+		*write = '\0';
+		if(end)
+			break;
+		read++;
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+
+/*
+ * starts argv[0], looked up in PATH, without a shell, stdin is read
+ * from inFd and stdout written to outFd, either one is /dev/null if
+ * it is -1 and stderr always is, the child starts with no signals
+ * blocked even if the calling thread blocks them,
+ * returns the pid of the child or -1 if it couldn't be started
+ */
+pid_t spawn_process(char* const argv[], int inFd, int outFd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+
+	if(posix_spawn_file_actions_init(&actions) != 0)
+		return -1;
+
+	if(posix_spawnattr_init(&attr) != 0)
+	{
+		posix_spawn_file_actions_destroy(&actions);
+		return -1;
+	}
+
+	if(inFd != -1)
+		posix_spawn_file_actions_adddup2(&actions, inFd, STDIN_FILENO);
+	else
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+	if(outFd != -1)
+		posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO);
+	else
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	//threads like the firewall executor run with every signal blocked
+	sigset_t none;
+	sigemptyset(&none);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	pid_t pid;
+	int status = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	return (status == 0) ? pid : -1;
+}
+
+
+/*
+ * waits for a child to exit, returns its exit status
+ * or -1 if it was killed or couldn't be waited for
+ */
+int wait_process(pid_t pid)
+{
+	int status;
+	pid_t result;
+
+	do
+		result = waitpid(pid, &status, 0);
+	while(result == -1 && errno == EINTR);
+
+	if(result == -1 || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+
+/*
+ * runs a command to completion with its output discarded,
+ * returns 1 if it exited with status 0, otherwise 0
+ */
+unsigned int run_process(char* const argv[])
+{
+	pid_t pid = spawn_process(argv, -1, -1);
+	if(pid == -1)
+		return 0;
+
+	return wait_process(pid) == 0;
+}
+
+
+/*
+ * this struct houses a child whose stdin or stdout is a pipe,
+ * it replaces popen without going through a shell
+ */
+typedef struct
+{
+	pid_t pid;
+	FILE* stream;
+} ProcessPipe;
+
+
+/*
+ * starts a command with a pipe to its stdin if mode is 'w' or from
+ * its stdout if mode is 'r', the other side is /dev/null,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must close process with close_process_pipe
+ */
+unsigned int open_process_pipe(ProcessPipe* process, char* const argv[], char mode)
+{
+	int fds[2];
+
+	if(pipe(fds) == -1)
+		return 0;
+
+	//close on exec so other children never hold the pipe open
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	unsigned int writing = mode == 'w';
+	int childFd = writing ? fds[0] : fds[1];
+	int parentFd = writing ? fds[1] : fds[0];
+
+	process->pid = writing ? spawn_process(argv, childFd, -1) : spawn_process(argv, -1, childFd);
+	close(childFd);
+
+	if(process->pid == -1)
+	{
+		close(parentFd);
+		return 0;
+	}
+
+	process->stream = fdopen(parentFd, writing ? "w" : "r");
+	if(process->stream == NULL)
+	{
+		close(parentFd);
+		wait_process(process->pid);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * closes the pipe of a command and waits for it to exit,
+ * returns 1 if it exited with status 0, otherwise 0
+ */
+unsigned int close_process_pipe(ProcessPipe* process)
+{
+	fclose(process->stream);
+	process->stream = NULL;
+	return wait_process(process->pid) == 0;
+}
+
+
+/*
+ * returns 1 if name is an executable in one of the
+ * directories of PATH, otherwise 0
+ */
+unsigned int program_in_path(const char* name)
+{
+	const char* path = getenv("PATH");
+	if(path == NULL)
+		path = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+
+	char candidate[PATH_MAX];
+
+	while(*path != '\0')
+	{
+		size_t length = strcspn(path, ":");
+
+		//an empty entry is the current directory
+		if(length == 0)
+			snprintf(candidate, sizeof(candidate), "./%s", name);
+		else
+			snprintf(candidate, sizeof(candidate), "%.*s/%s", (int) length, path, name);
+
+		if(access(candidate, X_OK) == 0)
+			return 1;
+
+		path += length;
+		if(*path == ':')
+			path++;
+	}
+
+	return 0;
+}
@@ -15,8 +15,8 @@ unsigned int write_config_file()
 	fprintf(fptr, "timeout=10\n\n");
 
 	fprintf(fptr, "#interval is in microseconds, 1 second = 1,000,000 microseconds,\n");
-	fprintf(fptr, "#it describes how often to check the logs, its worth noting logs\n");
-	fprintf(fptr, "#aren't checked unless the size of the file changes (new entries)\n");
+	fprintf(fptr, "#it describes how often to check knocking hosts for timeouts, logs\n");
+	fprintf(fptr, "#are watched with inotify and only polled this often if that fails\n");
 	fprintf(fptr, "interval=200000\n\n");
 	
 	fprintf(fptr, "#firewallResponse determines whether connection attempts to\n");
@@ -28,11 +28,37 @@ unsigned int write_config_file()
 	fprintf(fptr, "#this describes which ports to knock and in what order\n");
 	fprintf(fptr, "portsToKnock=\n\n");
 
+	fprintf(fptr, "#more sequences can be added with one knockSequence line each,\n");
+	fprintf(fptr, "#written as a name, a colon and the ports, e.g. admin:7000,8000,9000,\n");
+	fprintf(fptr, "#portsToKnock is the sequence named default, any of them opens the ports\n\n");
+
 	fprintf(fptr, "#put ports to protect here\n");
 	fprintf(fptr, "blacklistPorts=\n\n");
 
 	fprintf(fptr, "#put possible log locations here\n");
-	fprintf(fptr, "logLocations=/var/log/syslog\n");
+	fprintf(fptr, "logLocations=/var/log/syslog\n\n");
+
+	fprintf(fptr, "#logBackend is where knocks are read from, \"syslog\" reads the\n");
+	fprintf(fptr, "#messages written to logLocations, \"nflog\" reads packets straight\n");
+	fprintf(fptr, "#from the kernel through the nflog group below, bypassing syslog,\n");
+	fprintf(fptr, "#\"packet\" captures SYNs to the knock ports before the firewall sees them,\n");
+	fprintf(fptr, "#\"journal\" reads kernel messages from the systemd journal in the directory\n");
+	fprintf(fptr, "#below, or from the system journal if it is left empty\n");
+	fprintf(fptr, "logBackend=syslog\n");
+	fprintf(fptr, "nflogGroup=5\n");
+	fprintf(fptr, "journalDirectory=\n\n");
+	fprintf(fptr, "#firewallBackend is either \"iptables\" (with ipset) or \"nftables\",\n");
+	fprintf(fptr, "#nftables talks to the kernel directly and keeps its rules in its own table\n");
+	fprintf(fptr, "firewallBackend=iptables\n\n");
+	fprintf(fptr, "#logLevel is the least important kind of message written to log.txt,\n");
+	fprintf(fptr, "#\"debug\", \"info\", \"warning\" or \"error\", repeated messages are counted\n");
+	fprintf(fptr, "#instead of written again and log.txt is moved to log.txt.1 at 8 MB\n");
+	fprintf(fptr, "logLevel=info\n\n");
+	fprintf(fptr, "#metricsFile is where counters and latencies are written in the prometheus\n");
+	fprintf(fptr, "#text format every metricsInterval seconds, e.g. a .prom file in the\n");
+	fprintf(fptr, "#node_exporter textfile directory, nothing is written if it is left empty\n");
+	fprintf(fptr, "metricsFile=\n");
+	fprintf(fptr, "metricsInterval=15\n");
 
 	//close the file handle
 	fclose(fptr);
@@ -52,7 +78,7 @@ unsigned int check_config_file()
 	//general failure of obtaining file handle for config.txt
 	if(configFile == -1)
 	{
-		write_log("Failed to find or generate config.txt");
+		write_error("Failed to find or generate config.txt");
 		return 0;
 	}
 	
@@ -68,7 +94,7 @@ unsigned int check_config_file()
 		}
 		else
 		{
-			write_log("Config.txt file located but cannot populate it with default settings");
+			write_error("Config.txt file located but cannot populate it with default settings");
 			return 0;
 		}
 	}
@@ -84,8 +110,7 @@ unsigned int check_config_file()
  * to function adequately
  *
  * if the user lacks:
- * -iptables and nftables
- * -syslog
+ * -root privileges
  *
  * then logging and exiting with code 1 follows
  *
@@ -121,7 +146,7 @@ void check_requirements()
 	//and already exists
 	if(whitelistStatus == -1)
 	{
-		write_log("Failed to write or find whitelist.txt file");
+		write_error("Failed to write or find whitelist.txt file");
 		exit(1);
 	}
 	else if(whitelistStatus == 0)
@@ -135,15 +160,35 @@ void check_requirements()
 	//check for config file
 	if(check_config_file() == 0)
 	{
-		write_log("Failed to write or find config.txt file");
+		write_error("Failed to write or find config.txt file");
 		exit(1);
 	}
-		
-	//check for presence of iptables and nftables
-	int iptables = system("which iptables >/dev/null 2>&1");	
-	if(iptables != 0)
+}
+
+
+/*
+ * checks for the tools the configured firewall backend needs,
+ * nftables is spoken to over netlink so it needs none, iptables
+ * needs iptables and ipset
+ *
+ * side effect: this is an exit point for the whole program
+ */
+void check_firewall_requirements(Config* cfg)
+{
+	if(cfg == NULL || cfg->firewallBackend == FIREWALL_BACKEND_NFTABLES)
+		return;
+	
+	//check for presence of iptables
+	if(program_in_path("iptables") == 0)
+	{
+		write_error("Verify that either iptables is installed or firewallBackend is nftables");
+		exit(1);
+	}
+	
+	//whitelisted hosts are kept in an ipset
+	if(program_in_path("ipset") == 0)
 	{
-		write_log("Verify that either iptables is installed");
+		write_error("Verify that ipset is installed");
 		exit(1);
 	}
 }
@@ -1,12 +1,16 @@
 /*
  * this struct houses information about a hosts
- * knocking progress, including when it started
+ * knocking progress: when it started on the monotonic
+ * clock, how many ports it has knocked and the node of
+ * the knock program it has reached, a host is dropped
+ * the moment it knocks a wrong port so that is all
+ * there is to track
  */
 typedef struct
 {
-	char timestamp[10];
-	char host[16];
-	char** portsKnocked;
+	uint64_t startedNs;
+	uint32_t node;
+	unsigned int step;
 } Sequence;
 
 
@@ -17,62 +21,44 @@ void print_sequence(Sequence* seq)
 {
 	if(seq == NULL)
 		return;
-	
-	printf("timestamp: %s\n", seq->timestamp);
-	printf("host: %s\n", seq->host);
-	printf("portsKnocked:");
-	print_str_array(seq->portsKnocked);
-	printf("\n\n");
+
+	printf("knocking for: %.3f seconds\n", (double) (monotonic_ns() - seq->startedNs) / NS_PER_SECOND);
+	printf("ports knocked: %u\n\n", seq->step);
 }
 
 
 /*
- * constructs a sequence
- *
- * side effect: must return freed pointer
+ * fills in a sequence for a host that just knocked a first
+ * port at startedNs which took it to node, the sequence lives
+ * inside the host table so nothing is allocated
  */
-Sequence* construct_sequence(char* host, char** portsKnocked)
+void initialize_sequence(Sequence* seq, uint64_t startedNs, uint32_t node)
 {
-	if(host == NULL || portsKnocked == NULL)
-		return NULL;
-		
-	char* ctimeStr = get_current_time();
-	char* ctime = substring(ctimeStr, 7, 8);
-	
-	Sequence* seq = (Sequence*) malloc(sizeof(Sequence));
-	
 	if(seq == NULL)
-		return NULL;
-		
-	//instantiate members
-	strncpy(seq->timestamp, ctime, 8);
-	strncpy(seq->host, host, 15);
-	seq->portsKnocked = portsKnocked;
-	
-	//null terminate strings
-	seq->timestamp[8] = '\0';
-	seq->host[15] = '\0';
-		
-	//free time str
-	free(ctime);
-	return seq;
+		return;
+
+	seq->startedNs = startedNs;
+	seq->node = node;
+	seq->step = 1;
 }
 
 
 /*
- * destroys a sequence struct
+ * records the next port a host knocked,
+ * returns KNOCK_COMPLETED if a sequence is complete,
+ * KNOCK_ADVANCED if the host is still on track,
+ * KNOCK_IGNORED if it hit a first port again,
+ * KNOCK_FAILED if it knocked the wrong port and -1 on null input
  */
-void free_sequence(Sequence* seq)
+int advance_sequence(Sequence* seq, uint16_t port, KnockProgram* program)
 {
-	if(seq == NULL)
-		return;
-	
-	if(seq->portsKnocked != NULL)
-	{
-		char** ptrArray[] = {seq->portsKnocked};
-		free_all_double_char(ptrArray, 1);
-	}
-	
-	free(seq);
-	seq = NULL;
-}
\ No newline at end of file
+	if(seq == NULL || program == NULL)
+		return -1;
+
+	int status = knock_program_advance(program, &seq->node, port);
+
+	if(status == KNOCK_ADVANCED || status == KNOCK_COMPLETED)
+		seq->step++;
+
+	return status;
+}
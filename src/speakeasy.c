@@ -6,258 +6,1176 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter.h>
+#include <endian.h>
+#include <stdint.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
 
 
 #include "general_utils.h"
 #include "file_utils.h"
 #include "logging.h"
+#include "process.h"
+#include "metrics.h"
+#include "control.h"
+#include "knockprogram.h"
 #include "config.h"
 #include "logentry.h"
+#include "tag_scan.h"
+#include "logreader.h"
+#include "journal.h"
 #include "requirements.h"
+#include "nflog.h"
+#include "nftables.h"
+#include "packet_capture.h"
 #include "firewall.h"
 #include "sequence.h"
-#include "hostnode.h"
+#include "hosttable.h"
+#include "whitelist.h"
+#include "timerwheel.h"
+#include "watcher.h"
 
 
 //global pointers to allow for graceful cleanup
 //in case of shutdown occurring mid-process
 Config* _main_cfg = NULL;
-LogEntry* _main_log = NULL;
-HostNode* _main_head_node = NULL;
+HostTable _main_host_table = {0};
+TimerWheel _main_timer_wheel;
+Whitelist _main_whitelist = {0};
+WhitelistJournal _main_whitelist_journal = {.fd = -1};
+LogReader _main_log_reader = {0};
+JournalReader _main_journal_reader = {0};
+PacketRing _main_packet_ring = {.fd = -1};
+
+//set by SIGHUP, config.txt is read again at the end of the pass
+volatile sig_atomic_t _main_reload_requested = 0;
+
+//set by SIGINT and SIGTERM or a fatal error, the main loop
+//shuts down at the end of the pass
+volatile sig_atomic_t _main_stop_requested = 0;
+
+//the handled signals are read from here instead of interrupting the main loop
+int _main_signal_fd = -1;
 
 
 /*
- * handles signals sent from the OS
- * and performs cleanup using global pointers
+ * handles signals sent from the OS, only flags are set here
+ * since the main loop may be interrupted anywhere, it sees
+ * them once whatever it blocks on returns, signals read from
+ * the signal fd are handed here as well
  */
 void signal_handler(int sig)
 {		
 	//handle interrupt and term
 	if(sig == SIGINT || sig == SIGTERM)
-	{
-		//cleanup
-		if(_main_cfg != NULL)
-			free_config(_main_cfg);
-		if(_main_log != NULL)
-			free_log(_main_log);
-		
-		//account for if there are other nodes in chain
-		if(_main_head_node != NULL && _main_head_node->next != NULL)
-		{
-			free_hostlist(_main_head_node->next);
-			free_hostnode(_main_head_node);
-		}
-		else if(_main_head_node != NULL)
-			free_hostnode(_main_head_node);
-		
-		exit(0);
-	}
+		_main_stop_requested = 1;
+	
+	//reloading touches everything knocks do so it waits for the main loop
+	if(sig == SIGHUP)
+		_main_reload_requested = 1;
+}
+
+
+/*
+ * blocks the handled signals and has them queue up on a signal fd
+ * which every wait of the main loop watches, a signal that comes
+ * in right before the loop goes to sleep then still wakes it up,
+ * returns 1 if successful otherwise 0 and the signal handler is
+ * left to interrupt the waits as before
+ */
+unsigned int open_signal_fd()
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGUSR1);
+	
+	_main_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(_main_signal_fd == -1)
+		return 0;
+	
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	return 1;
+}
+
+
+/*
+ * hands every signal queued on the signal fd to the signal handler
+ */
+void read_pending_signals()
+{
+	if(_main_signal_fd == -1)
+		return;
+	
+	struct signalfd_siginfo info;
+	while(read(_main_signal_fd, &info, sizeof(info)) == sizeof(info))
+		signal_handler(info.ssi_signo);
+}
+
+
+/*
+ * performs cleanup using global pointers once the main
+ * loop was asked to stop
+ */
+void shutdown_port_knocking()
+{
+	//new speakeasy-ctl clients are turned away right away
+	close_control_socket(&_control_socket);
+	
+	//remember where the log was left off, the log file is closed with the config
+	if(_main_log_reader.buffer != NULL)
+		save_log_reader_state(&_main_log_reader, LOG_READER_STATE_FILE);
+	if(_main_journal_reader.journal != NULL)
+		save_journal_cursor(&_main_journal_reader, JOURNAL_CURSOR_FILE);
+
+	//whitelist changes of the last pass may not have been synced yet
+	close_whitelist_journal(&_main_whitelist_journal);
+	
+	//firewall changes already handed off are let through
+	stop_firewall_executor();
+
+	//cleanup
+	if(_main_cfg != NULL)
+		free_config(_main_cfg);
+	_main_cfg = NULL;
+	
+	free_host_table(&_main_host_table);
+	free_timer_wheel(&_main_timer_wheel);
+	free_whitelist(&_main_whitelist);
+	free_log_reader(&_main_log_reader);
+	free_journal_reader(&_main_journal_reader);
+	free_packet_ring(&_main_packet_ring);
+	
+	write_log("Shut down");
 }
 
 
 /*
  * this function is called in response to activity from
  * a host that is already being monitored and decides whether
- * they are to be removed from the chain, whitelisted, or left alone
+ * they are to be removed from the table, whitelisted, or left alone
  * until they complete the sequence
  */
-void update_host_status(char* host, char* port)
+void update_host_status(HostEntry* entry, char* host, uint16_t port)
 {
-	if(host == NULL || port == NULL)
+	if(entry == NULL || host == NULL)
 		return;
 	
-	//obtain node using host string
-	HostNode* node = get_hostnode(_main_head_node, host);
-	if(node == NULL)
-		return;
-
-	//get to next vacant spot in hosts sequence
-	unsigned int i = 0;
-	while(node->seq->portsKnocked[i] != NULL && node->seq->portsKnocked[i][0] != '\0')
-		i++;
+	//add port to host sequence and check if they failed the config sequence
+	int knockingStatus = advance_sequence(&entry->seq, port, _main_cfg->knockProgram);
 	
-	//copy port to host sequence and check if they failed the config sequence
-	strcpy(node->seq->portsKnocked[i], port);
-	int knockingStatus = str_array_subarray(node->seq->portsKnocked, _main_cfg->portsToKnock);
-	
-	if(knockingStatus == 0)
+	if(knockingStatus == KNOCK_FAILED)
 	{
-		iptables_stop_logging_host("1", "65535", host);
-		free_hostnode(node);
+		metric_add(METRIC_HOSTS_FAILED, 1);
+		firewall_stop_logging_host(host);
 		write_log_two("Host failed port knocking sequence: ", host);
+		host_table_remove(&_main_host_table, entry);
 		return;
 	}
 	
 	//haven't failed the sequence yet so do nothing
-	if(knockingStatus == 1)
+	if(knockingStatus == KNOCK_ADVANCED)
+	{
+		metric_add(METRIC_KNOCKS_MATCHED, 1);
+		write_debug_two("Host advanced in port knocking sequence: ", host);
+	}
+	if(knockingStatus == KNOCK_ADVANCED || knockingStatus == KNOCK_IGNORED)
 		return;
 	
 	//they've completed the sequence
-	if(knockingStatus == 2)
+	if(knockingStatus == KNOCK_COMPLETED)
 	{
-		//handle hosts already whitelisted
-		FILE* whitelist = read_file("whitelist.txt");
-		if(whitelist != NULL)
+		metric_add(METRIC_KNOCKS_MATCHED, 1);
+		
+		//handle hosts that were whitelisted while they were knocking
+		if(whitelist_has_address(&_main_whitelist, entry->addr))
 		{
-			//they've already been whitelisted
-			long lineNum = get_line_num(whitelist, host);
-			if(lineNum != -1 && lineNum != -2)
-			{
-				//stop logging host and remove from whitelist
-				iptables_stop_logging_host("1", "65535", host);
-
-				unsigned int fileStatus = remove_line_from_file(whitelist, lineNum);
-				if(fileStatus)
-					write_log_two("Removed previously authenticated host from whitelist file: ", host);
-				else
-					write_log_two("Failed to remove previously authenticated host from whitelist file: ", host);
-
-				unsigned int iptablesStatus = iptables_remove_host(host);
-				if(iptablesStatus)
-					write_log_two("Removed previously authenticated host from iptables: ", host);
-				else
-					write_log_two("Failed to remove previously authenticated host from iptables: ", host);
-
-				free_hostnode(node);
-				fclose(whitelist);
-				return;
-			}
-			fclose(whitelist);
+			metric_add(METRIC_HOSTS_REVOKED, 1);
+			
+			//stop logging host and remove from whitelist
+			firewall_stop_logging_host(host);
+			whitelist_remove_address(&_main_whitelist, entry->addr);
+
+			unsigned int fileStatus = whitelist_journal_append(&_main_whitelist_journal, '-', host);
+			if(fileStatus)
+				write_log_two("Removed previously authenticated host from whitelist journal: ", host);
+			else
+				write_error_two("Failed to remove previously authenticated host from whitelist journal: ", host);
+
+			unsigned int iptablesStatus = firewall_remove_host(host);
+			if(iptablesStatus)
+				write_log_two("Removed previously authenticated host from iptables: ", host);
+			else
+				write_error_two("Failed to remove previously authenticated host from iptables: ", host);
+
+			host_table_remove(&_main_host_table, entry);
+			return;
 		}
 
 		//otherwise whitelist them
-		iptables_stop_logging_host("1", "65535", host);
-		iptables_whitelist_host(host);
-		append_to_file("whitelist.txt", host);
-		free_hostnode(node);
-		write_log_two("Host completed sequence, authentication complete: ", host);
+		metric_add(METRIC_HOSTS_AUTHENTICATED, 1);
+		firewall_stop_logging_host(host);
+		firewall_whitelist_host(host);
+		whitelist_add_address(&_main_whitelist, entry->addr);
+		if(whitelist_journal_append(&_main_whitelist_journal, '+', host) == 0)
+			write_error_two("Failed to add authenticated host to whitelist journal: ", host);
+		char message[96];
+		snprintf(message, sizeof(message), "Host completed sequence %s, authentication complete: ",
+				 knock_program_sequence_name(_main_cfg->knockProgram, entry->seq.node));
+		write_log_two(message, host);
+		host_table_remove(&_main_host_table, entry);
 	}
 }
 
 
 /*
- * this function is called in response to a host knocking the 
- * first port in the port-knocking sequence specified by config
+ * this function is called in response to a new host knocking the
+ * first port of one of the knock sequences specified by config
  * and manages monitoring various potential clients, it does this 
- * by dynamically manipulating firewall logging rules and searching 
- * through a linked list of hosts to assess progress in the port 
- * knocking process
+ * by dynamically manipulating firewall logging rules and keeping
+ * each host's progress in the port knocking process in the host table,
+ * entry was just added for the host, node is where the knock led and
+ * knockNs is when it was made on the monotonic_ns clock
  */
-void start_monitoring_host(char* host)
+void start_monitoring_host(HostEntry* entry, char* host, uint32_t node, uint64_t knockNs)
 {
-	if(host == NULL)
+	if(entry == NULL || host == NULL)
 		return;
 	
-	//check if they're already whitelisted
-	FILE* whitelist = read_file("whitelist.txt");
-	if(whitelist != NULL)
-	{
-		if(get_line_num(whitelist, "host") != -1)
-			return;
-		fclose(whitelist);
-	}
+	uint32_t addr = entry->addr;
+	
+	//they are only given to this function if they've successfully
+	//knocked the first port so the sequence starts one port in
+	initialize_sequence(&entry->seq, knockNs, node);
+	
+	//the timeout is scheduled once, here
+	entry->deadline = timer_tick_at(entry->seq.startedNs + (uint64_t) _main_cfg->timeout * NS_PER_SECOND);
+	timer_wheel_schedule(&_main_timer_wheel, addr, entry->deadline);
 	
 	//log host spotted
+	metric_add(METRIC_KNOCKS_MATCHED, 1);
+	metric_add(METRIC_HOSTS_STARTED, 1);
 	write_log_two("Host hit first port in port knocking sequence: ", host);
 	
-	//find length of portsToKnock in config
-	int lengthOfPortsToKnock = str_array_size(_main_cfg->portsToKnock);
+	//start logging connections from this host
+	firewall_start_logging_host(host);
+}
+
+
+/*
+ * advances the timer wheel to now and removes every host whose knock
+ * timed out, hosts that already finished or started over since their
+ * timeout was scheduled are skipped
+ */
+void expire_knocking_hosts()
+{
+	TimerList* expired = timer_wheel_advance(&_main_timer_wheel, timer_current_tick());
+	if(expired == NULL)
+		return;
+	
+	for(unsigned int i = 0; i < expired->count; i++)
+	{
+		TimerItem* item = &expired->items[i];
+		HostEntry* entry = host_table_find(&_main_host_table, item->addr);
+		
+		if(entry != NULL && entry->deadline == item->deadline)
+			remove_expired_host(&_main_host_table, entry);
+	}
+}
+
+
+/*
+ * decides what a single knock means for the host that sent it
+ */
+void apply_log_entry(LogEntry* log)
+{
+	//the table is keyed by the binary address
+	uint32_t addr;
+	if(inet_pton(AF_INET, log->src, &addr) != 1)
+		return;
 	
-	//make new char** with enough space to store the whole sequence
-	char** portsKnocked = str_array_initialize_with_null(lengthOfPortsToKnock, 5);
+	int port = atoi(log->dpt);
+	if(port <= 0 || port > 65535)
+		return;
 	
-	//set first port in the ports they've knocked equal to first 
-	//port in port knocking sequence, because they are only given
-	//to this function if they've successfully knocked the first port
-	strcpy(portsKnocked[0], _main_cfg->portsToKnock[0]);
+	//a knock older than the timeout can't be part of a sequence anymore,
+	//neither can one from before this boot that the clock can't place
+	uint64_t timeoutNs = (uint64_t) _main_cfg->timeout * NS_PER_SECOND;
+	uint64_t now = monotonic_ns();
+	if(log->ageNs > timeoutNs || log->ageNs >= now)
+	{
+		write_debug_two("Ignored knock from before the timeout: ", log->src);
+		return;
+	}
+	uint64_t knockNs = now - log->ageNs;
 	
-	//construct sequence
-	Sequence* seq = construct_sequence(host, portsKnocked);
+	//knocks read back after a restart come in faster than they were
+	//made, so a sequence that outlasted the timeout is ended here
+	//rather than by the timer wheel which only sees the present
+	HostEntry* known = host_table_find(&_main_host_table, addr);
+	if(known != NULL && knockNs > known->seq.startedNs + timeoutNs)
+		remove_expired_host(&_main_host_table, known);
 	
-	//construct hostnode and link it into the chain
-	HostNode* nodeToAdd = construct_hostnode(NULL, seq, NULL);
-	append_hostnode(_main_head_node, nodeToAdd);
+	//a first port can start a new host, otherwise only known hosts matter
+	uint32_t node = knock_program_next(_main_cfg->knockProgram, KNOCK_ROOT, port);
+	if(node == KNOCK_NO_NODE)
+	{
+		update_host_status(host_table_find(&_main_host_table, addr), log->src, port);
+		return;
+	}
 	
-	//start logging connections from this host
-	iptables_log_ports("1", "65535", host);
+	//whitelisted hosts are already let in, there is nothing to track
+	if(whitelist_contains(&_main_whitelist, addr))
+		return;
+	
+	//one probe finds the host or makes room for it
+	unsigned int inserted;
+	HostEntry* entry = host_table_insert(&_main_host_table, addr, &inserted);
+	
+	if(entry != NULL && inserted)
+		start_monitoring_host(entry, log->src, node, knockNs);
+	else if(entry != NULL)
+		update_host_status(entry, log->src, port);
+}
+
+
+/*
+ * hands a single knock to apply_log_entry and records how long it
+ * took, this is shared by every log backend
+ */
+void process_log_entry(LogEntry* log)
+{
+	if(log == NULL || _main_cfg == NULL)
+		return;
+	
+	uint64_t startNs = monotonic_ns();
+	apply_log_entry(log);
+	metric_observe(METRIC_STATE_UPDATE_SECONDS, startNs);
+}
+
+
+/*
+ * hands a knock read back from before a restart to process_log_entry,
+ * the kernel timestamp counts from boot like the monotonic_ns clock
+ * so it tells how old the knock is, a timestamp ahead of the clock
+ * is from before a reboot, a knock without one is taken as new
+ */
+void replay_log_entry(LogEntry* log)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t knockNs = log->kernelTimeUs * 1000;
+	
+	//the two clocks drift apart a little, so only a timestamp
+	//further ahead than the timeout means an earlier boot
+	if(log->kernelTimeUs != 0 && knockNs > now + (uint64_t) _main_cfg->timeout * NS_PER_SECOND)
+		log->ageNs = UINT64_MAX;
+	else if(log->kernelTimeUs != 0 && knockNs < now)
+		log->ageNs = now - knockNs;
+	
+	process_log_entry(log);
+}
+
+
+/*
+ * called with every firewall change the executor failed to apply, it
+ * is queued again unless a later change undid it in the meantime
+ * or it already failed FIREWALL_RETRY_LIMIT times
+ */
+void retry_firewall_change(FirewallOp* op)
+{
+	//ipset entries follow the whitelist in memory, rules the rule cache
+	unsigned int present;
+	if(op->ipset)
+		present = whitelist_has_entry(&_main_whitelist, op->spec);
+	else
+		present = iptables_check_rule(op->chain, op->spec);
+	
+	if(present == (op->action == 'D'))
+		return;
+	
+	char change[256];
+	snprintf(change, sizeof(change), "%s %s", op->chain, op->spec);
+	
+	if(++op->attempts > FIREWALL_RETRY_LIMIT)
+	{
+		write_error_two("Gave up on firewall change after retrying: ", change);
+		rule_cache_revert(op);
+		return;
+	}
+	
+	write_error_two("Failed to apply firewall change, retrying: ", change);
+	metric_add(METRIC_FIREWALL_OPS_RETRIED, 1);
+	iptables_batch_queue(op);
+}
+
+
+/*
+ * sets the gauges from the state the main thread keeps
+ */
+void update_metric_gauges()
+{
+	metric_set(METRIC_TRACKED_HOSTS, _main_host_table.count);
+	metric_set(METRIC_WHITELIST_ENTRIES, _main_whitelist.count + _main_whitelist.numRanges);
+	metric_set(METRIC_FIREWALL_QUEUE, firewall_executor_queued());
+}
+
+
+/*
+ * writes the metrics file if metricsFile is set and metricsInterval
+ * seconds went by since it was last written
+ */
+void export_metrics_throttled()
+{
+	static uint64_t lastNs = 0;
+	
+	if(_main_cfg->metricsFile == NULL)
+		return;
+	
+	uint64_t now = monotonic_ns();
+	if(lastNs != 0 && now - lastNs < (uint64_t) _main_cfg->metricsInterval * NS_PER_SECOND)
+		return;
+	
+	lastNs = now;
+	update_metric_gauges();
+	
+	if(write_metrics_file(_main_cfg->metricsFile) == 0)
+		write_error_two("Failed to write metrics file: ", _main_cfg->metricsFile);
+}
+
+
+/*
+ * stops tracking every knocking host inside network and mask, a mask
+ * of 0 matches all of them, returns how many hosts were dropped
+ */
+unsigned int forget_knocking_hosts(uint32_t network, uint32_t mask)
+{
+	unsigned int removed = 0;
+	
+	for(unsigned int i = 0; i < _main_host_table.capacity; i++)
+	{
+		HostEntry* entry = &_main_host_table.entries[i];
+		if(entry->state != HOST_SLOT_USED || (entry->addr & mask) != network)
+			continue;
+		
+		char host[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &entry->addr, host, sizeof(host));
+		firewall_stop_logging_host(host);
+		host_table_remove(&_main_host_table, entry);
+		removed++;
+	}
+	
+	return removed;
+}
+
+
+/*
+ * writes one line about a knocking host for speakeasy-ctl
+ */
+void write_knocking_host(FILE* out, HostEntry* entry)
+{
+	char host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &entry->addr, host, sizeof(host));
+	
+	uint64_t now = monotonic_ns();
+	uint64_t deadline = entry->seq.startedNs + (uint64_t) _main_cfg->timeout * NS_PER_SECOND;
+	double left = (deadline > now) ? (deadline - now) / 1e9 : 0;
+	
+	fprintf(out, "%s knocked %u ports, started %.1fs ago, times out in %.1fs\n", host,
+			entry->seq.step, (now - entry->seq.startedNs) / 1e9, left);
+}
+
+
+/*
+ * takes an entry that is whitelisted as it is off the whitelist,
+ * out of the journal and out of the firewall
+ */
+void unwhitelist_entry(char* entry)
+{
+	whitelist_remove_entry(&_main_whitelist, entry);
+	
+	if(whitelist_journal_append(&_main_whitelist_journal, '-', entry) == 0)
+		write_error_two("Failed to remove host from whitelist journal: ", entry);
+	
+	if(firewall_remove_host(entry) == 0)
+		write_error_two("Failed to remove host from firewall: ", entry);
+}
+
+
+/*
+ * whitelist-add, lets an address or cidr range in as if it had knocked,
+ * hosts in it that are still knocking don't have to finish anymore
+ */
+void control_whitelist_add(char* arg, FILE* out)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(arg, &addr, &mask) == 0)
+	{
+		fprintf(out, "error: not an address or cidr range: %s\n", arg);
+		return;
+	}
+	
+	char entry[INET_ADDRSTRLEN + 4];
+	format_whitelist_entry(addr, mask, entry, sizeof(entry));
+	
+	if(whitelist_has_entry(&_main_whitelist, entry))
+	{
+		fprintf(out, "error: already whitelisted: %s\n", entry);
+		return;
+	}
+	
+	if(whitelist_add_entry(&_main_whitelist, entry) == 0)
+	{
+		fprintf(out, "error: failed to allocate whitelist entry\n");
+		return;
+	}
+	
+	if(whitelist_journal_append(&_main_whitelist_journal, '+', entry) == 0)
+		write_error_two("Failed to add host to whitelist journal: ", entry);
+	
+	if(firewall_whitelist_host(entry) == 0)
+		write_error_two("Failed to whitelist host in firewall: ", entry);
+	
+	forget_knocking_hosts(addr, mask);
+	write_log_two("Whitelisted through control socket: ", entry);
+	fprintf(out, "ok\nwhitelisted %s\n", entry);
+}
+
+
+/*
+ * whitelist-remove, takes an address or cidr range off the whitelist,
+ * a range only by the exact same range
+ */
+void control_whitelist_remove(char* arg, FILE* out)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(arg, &addr, &mask) == 0)
+	{
+		fprintf(out, "error: not an address or cidr range: %s\n", arg);
+		return;
+	}
+	
+	char entry[INET_ADDRSTRLEN + 4];
+	format_whitelist_entry(addr, mask, entry, sizeof(entry));
+	
+	if(whitelist_has_entry(&_main_whitelist, entry) == 0)
+	{
+		fprintf(out, "error: not on the whitelist: %s\n", entry);
+		return;
+	}
+	
+	unwhitelist_entry(entry);
+	write_log_two("Removed from whitelist through control socket: ", entry);
+	fprintf(out, "ok\nremoved %s\n", entry);
+}
+
+
+/*
+ * revoke, takes a single host's access away, whether it authenticated
+ * or is still knocking, it has to knock the whole sequence again
+ */
+void control_revoke(char* arg, FILE* out)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(arg, &addr, &mask) == 0 || mask != 0xffffffffu)
+	{
+		fprintf(out, "error: not an address: %s\n", arg);
+		return;
+	}
+	
+	char host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr, host, sizeof(host));
+	
+	unsigned int whitelisted = whitelist_has_address(&_main_whitelist, addr);
+	
+	//a host let in by a range can only lose access with the whole range
+	if(whitelisted == 0 && whitelist_contains(&_main_whitelist, addr))
+	{
+		fprintf(out, "error: %s is in a whitelisted range, remove the range instead\n", host);
+		return;
+	}
+	
+	unsigned int knocking = forget_knocking_hosts(addr, mask);
+	if(whitelisted)
+		unwhitelist_entry(host);
+	
+	if(whitelisted == 0 && knocking == 0)
+	{
+		fprintf(out, "error: %s is neither whitelisted nor knocking\n", host);
+		return;
+	}
+	
+	write_log_two("Revoked host through control socket: ", host);
+	fprintf(out, "ok\nrevoked %s\n", host);
+}
+
+
+/*
+ * show-host, tells whether an address is whitelisted and how far it got knocking
+ */
+void control_show_host(char* arg, FILE* out)
+{
+	uint32_t addr;
+	if(inet_pton(AF_INET, arg, &addr) != 1)
+	{
+		fprintf(out, "error: not an address: %s\n", arg);
+		return;
+	}
+	
+	fprintf(out, "ok\n");
+	
+	if(whitelist_has_address(&_main_whitelist, addr))
+		fprintf(out, "whitelisted\n");
+	else if(whitelist_contains(&_main_whitelist, addr))
+		fprintf(out, "whitelisted by range\n");
+	else
+		fprintf(out, "not whitelisted\n");
+	
+	HostEntry* entry = host_table_find(&_main_host_table, addr);
+	if(entry != NULL)
+		write_knocking_host(out, entry);
+	else
+		fprintf(out, "not knocking\n");
 }
 
 
 /*
- * this function checks if a host has timed out of the knocking process,
- * if they have they are removed from the host chain
+ * answers one request of speakeasy-ctl, the first line of the response
+ * is "ok" or "error: " followed by the reason, anything after it is
+ * what the command prints, changes go out with the rest of the pass
  */
-void check_hostlist_for_timeouts()
+void handle_control_request(char* request, FILE* out)
 {
-	if(_main_head_node == NULL || _main_cfg == NULL)
+	char* argv[4];
+	int argc = split_arguments(request, argv, 4);
+	
+	if(argc < 1)
+	{
+		fprintf(out, "error: empty request\n");
 		return;
+	}
 	
-	HostNode* curr = _main_head_node;
-	HostNode* currNext;
+	char* command = argv[0];
+	unsigned int wantsHost = strcmp(command, "show-host") == 0 || strcmp(command, "whitelist-add") == 0 ||
+							 strcmp(command, "whitelist-remove") == 0 || strcmp(command, "revoke") == 0;
 	
-	while(curr != NULL && curr->next != NULL)
+	if(argc != (wantsHost ? 2 : 1))
 	{
-		//save the next node
-		currNext = curr->next;
-		if(currNext->seq != NULL && free_hostnode_if_expired(currNext, _main_cfg))
+		fprintf(out, "error: %s takes %s\n", command, wantsHost ? "one argument" : "no arguments");
+		return;
+	}
+	
+	if(strcmp(command, "list-tracked-hosts") == 0)
+	{
+		fprintf(out, "ok\n");
+		for(unsigned int i = 0; i < _main_host_table.capacity; i++)
 		{
-			//if the node was freed, next now points to freed memory
-			//the next iteration will continue from the current node
+			if(_main_host_table.entries[i].state == HOST_SLOT_USED)
+				write_knocking_host(out, &_main_host_table.entries[i]);
+		}
+	}
+	else if(strcmp(command, "show-host") == 0)
+		control_show_host(argv[1], out);
+	else if(strcmp(command, "whitelist-add") == 0)
+		control_whitelist_add(argv[1], out);
+	else if(strcmp(command, "whitelist-remove") == 0)
+		control_whitelist_remove(argv[1], out);
+	else if(strcmp(command, "revoke") == 0)
+		control_revoke(argv[1], out);
+	else if(strcmp(command, "flush-knocking") == 0)
+	{
+		unsigned int removed = forget_knocking_hosts(0, 0);
+		write_log("Flushed knocking hosts through control socket");
+		fprintf(out, "ok\nstopped tracking %u hosts\n", removed);
+	}
+	else if(strcmp(command, "stats") == 0)
+	{
+		update_metric_gauges();
+		fprintf(out, "ok\n");
+		write_metrics(out);
+	}
+	else
+		fprintf(out, "error: unknown command: %s\n", command);
+}
+
+
+/*
+ * moves every knocking host over to the knock program of a reloaded
+ * config, a host keeps its progress if the ports it knocked so far
+ * still lead somewhere in it, otherwise it is dropped and has to start
+ * over, timeouts are scheduled again if the timeout changed
+ */
+void migrate_knocking_hosts(Config* old, Config* cfg)
+{
+	unsigned int dropped = 0;
+	
+	for(unsigned int i = 0; i < _main_host_table.capacity; i++)
+	{
+		HostEntry* entry = &_main_host_table.entries[i];
+		if(entry->state != HOST_SLOT_USED)
 			continue;
+		
+		uint16_t ports[KNOCK_MAX_PATH];
+		int length = knock_program_path(old->knockProgram, entry->seq.node, ports, KNOCK_MAX_PATH);
+		
+		uint32_t node = (length > 0) ? KNOCK_ROOT : KNOCK_NO_NODE;
+		for(int p = 0; p < length && node != KNOCK_NO_NODE; p++)
+			node = knock_program_next(cfg->knockProgram, node, ports[p]);
+		
+		//a sequence that is already complete in the new config wasn't knocked to its end
+		if(node == KNOCK_NO_NODE || cfg->knockProgram->sequenceAt[node] != -1)
+		{
+			char host[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &entry->addr, host, sizeof(host));
+			firewall_stop_logging_host(host);
+			host_table_remove(&_main_host_table, entry);
+			dropped++;
+			continue;
+		}
+		
+		entry->seq.node = node;
+		
+		//the timer with the old deadline is skipped once it fires
+		if(cfg->timeout != old->timeout)
+		{
+			entry->deadline = timer_tick_at(entry->seq.startedNs + (uint64_t) cfg->timeout * NS_PER_SECOND);
+			timer_wheel_schedule(&_main_timer_wheel, entry->addr, entry->deadline);
 		}
-		curr = currNext;
+	}
+	
+	if(dropped > 0)
+	{
+		char message[96];
+		snprintf(message, sizeof(message), "Dropped %u knocking hosts whose sequence is gone after the reload", dropped);
+		write_log(message);
 	}
 }
 
 
 /*
- * provided with a config file pointer this function starts
- * the logic that runs the whole program in a loop:
+ * reads config.txt again and switches to it without a restart, only
+ * the firewall rules that differ are changed and knocking hosts carry
+ * on, the running config stays if the new one can't be used, where
+ * knocks are read from and the firewall backend need a restart
+ */
+void reload_config()
+{
+	FILE* cfgFptr = read_file("config.txt");
+	Config* fresh = (cfgFptr != NULL) ? construct_config(cfgFptr) : NULL;
+	if(cfgFptr != NULL)
+		fclose(cfgFptr);
+	
+	if(fresh == NULL)
+	{
+		write_error("Check config.txt for issues, keeping the running configuration");
+		return;
+	}
+	
+	Config* cfg = _main_cfg;
+	
+	//the loops already read from these, so the running ones are kept
+	unsigned int sameSource = fresh->logBackend == cfg->logBackend && fresh->nflogGroup == cfg->nflogGroup &&
+							  fresh->firewallBackend == cfg->firewallBackend &&
+							  (fresh->journalDirectory == NULL) == (cfg->journalDirectory == NULL) &&
+							  (cfg->journalDirectory == NULL || strcmp(fresh->journalDirectory, cfg->journalDirectory) == 0) &&
+							  (fresh->logPath == NULL) == (cfg->logPath == NULL) &&
+							  (cfg->logPath == NULL || strcmp(fresh->logPath, cfg->logPath) == 0);
+	if(sameSource == 0)
+		write_warning("logBackend, nflogGroup, firewallBackend, journalDirectory and logLocations only change on a restart");
+	
+	//the packet filter and nftables are replaced in one step each and
+	//stay as they were if that fails, so they go first
+	if(cfg->logBackend == LOG_BACKEND_PACKET && attach_knock_filter(_main_packet_ring.fd, fresh->knockProgram) == 0)
+	{
+		write_error("Failed to attach the new knock port filter, keeping the running configuration");
+		free_config(fresh);
+		return;
+	}
+	
+	fresh->logBackend = cfg->logBackend;
+	fresh->nflogGroup = cfg->nflogGroup;
+	fresh->firewallBackend = cfg->firewallBackend;
+	
+	if(reload_firewall(cfg, fresh) == 0)
+	{
+		write_error("Failed to reload firewall rules, keeping the running configuration");
+		if(cfg->logBackend == LOG_BACKEND_PACKET)
+			attach_knock_filter(_main_packet_ring.fd, cfg->knockProgram);
+		free_config(fresh);
+		return;
+	}
+	
+	migrate_knocking_hosts(cfg, fresh);
+	
+	//the running log file and journal are handed to the new config
+	char* journalDirectory = fresh->journalDirectory;
+	char** logLocations = fresh->logLocations;
+	char* logPath = fresh->logPath;
+	FILE* logFile = fresh->logFile;
+	fresh->journalDirectory = cfg->journalDirectory;
+	fresh->logLocations = cfg->logLocations;
+	fresh->logPath = cfg->logPath;
+	fresh->logFile = cfg->logFile;
+	cfg->journalDirectory = journalDirectory;
+	cfg->logLocations = logLocations;
+	cfg->logPath = logPath;
+	cfg->logFile = logFile;
+	
+	//everything holds on to _main_cfg, so the contents are swapped
+	//and the old ones freed with the struct that now holds them
+	Config old = *cfg;
+	*cfg = *fresh;
+	*fresh = old;
+	free_config(fresh);
+	
+	set_log_level(cfg->logLevel);
+	write_log("Reloaded config.txt");
+}
+
+
+/*
+ * ends one pass of the main loop, knocking hosts are checked for
+ * timeouts and then every firewall change made during the pass
+ * is handed to the executor in one go, if a stop was asked for
+ * everything is shut down after that,
+ * returns 0 once the main loop has to return otherwise 1
+ */
+unsigned int finish_processing_pass()
+{
+	//signals that woke up the pass set their flags now
+	read_pending_signals();
+	
+	//changes that failed in earlier passes go out again with this one
+	poll_firewall_executor(retry_firewall_change);
+	
+	//a speakeasy-ctl request changes the same state knocks do
+	poll_control_socket(&_control_socket, handle_control_request);
+	
+	//a reload goes before the timeout check so the new timeout counts
+	if(_main_reload_requested)
+	{
+		_main_reload_requested = 0;
+		reload_config();
+	}
+	
+	//if there are timeouts pending see which ones came due, their
+	//firewall cleanup goes out with the rest of the pass
+	if(_main_timer_wheel.count > 0)
+		expire_knocking_hosts();
+	
+	firewall_batch_commit();
+
+	//whitelist changes of the pass reach the disk with one sync
+	if(whitelist_journal_sync(&_main_whitelist_journal) == 0)
+		write_error("Failed to sync " WHITELIST_JOURNAL_FILE);
+	if(whitelist_journal_compact(&_main_whitelist_journal, &_main_whitelist) == 0)
+		write_error("Failed to compact " WHITELIST_JOURNAL_FILE);
+	
+	export_metrics_throttled();
+	
+	if(_main_stop_requested)
+	{
+		shutdown_port_knocking();
+		return 0;
+	}
+	
+	return 1;
+}
+
+
+/*
+ * lets every address and range of the whitelist through the firewall
+ */
+void apply_whitelist()
+{
+	char text[INET_ADDRSTRLEN + 4];
+	unsigned int cursor = 0;
+	
+	firewall_batch_begin();
+	
+	while(whitelist_next_entry(&_main_whitelist, &cursor, text, sizeof(text)))
+		firewall_whitelist_host(text);
+	
+	if(firewall_batch_commit() == 0)
+		write_error("Some whitelisted hosts failed to apply during setup");
+}
+
+
+/*
+ * provided with a config file pointer and what to do with every
+ * knock this function starts the logic that runs the whole program in a loop:
  *  -verifies that syslog has changed
  *  -constructs logs from syslog
  *  -checks order of attempted connections
  *  -adjusts firewall accordingly
  */
-void parse_log_for_entries(Config* cfg)
+void parse_log_for_entries(Config* cfg, void (*handler)(LogEntry*))
 {	
-	//find tagged lines in syslog and construct a LogEntry
-	char* logString = "";
+	//look at the file first so the old one is drained before switching
+	int fileStatus = check_log_file(&_main_log_reader, cfg->logPath);
 	
-	while(logString != NULL)
-	{			
-		logString = get_line_no_rewind(cfg->logFile, "Speakeasy-log");
-		LogEntry* currLog = construct_log(logString);
-		
-		//set global pointer _main_log to currLog
-		_main_log = currLog;
-		
-		//free the string parsing result
-		free(logString);
+	//only the tagged lines of newly appended data are parsed
+	if(read_log_entries(&_main_log_reader, handler) == -1)
+		write_error("Failed to read from log file");
+	
+	if(fileStatus == LOG_FILE_ROTATED && reopen_log_file(cfg))
+	{
+		//everything in the new file is unread
+		reset_log_reader(&_main_log_reader, fileno(cfg->logFile), 0);
+		read_log_entries(&_main_log_reader, handler);
+	}
+	else if(fileStatus == LOG_FILE_TRUNCATED)
+	{
+		write_log_two("Log file was truncated, reading it from the start: ", cfg->logPath);
+		reset_log_reader(&_main_log_reader, _main_log_reader.fd, 0);
+		read_log_entries(&_main_log_reader, handler);
+	}
+	
+	save_log_reader_state_throttled(&_main_log_reader, LOG_READER_STATE_FILE);
+}
+
+
+/*
+ * returns how long the main loop may block waiting for knocks
+ * in milliseconds, -1 (forever) unless hosts are knocking since
+ * they have to be checked for timeouts every interval, the
+ * firewall executor is still at work or metrics are written
+ */
+int knock_wait_timeout_ms(Config* cfg)
+{
+	if(_main_host_table.count > 0)
+		return (cfg->interval + 999) / 1000;
+	
+	//failed firewall changes have to be picked up to be retried
+	if(firewall_executor_busy())
+		return EXECUTOR_POLL_MS;
+	
+	//the metrics file is rewritten even while nobody knocks
+	if(cfg->metricsFile != NULL)
+		return cfg->metricsInterval * 1000;
 	
-		if(_main_log != NULL)
-		{			
-			//check if new host to be added or if they are already in the chain
-			if(strcmp(_main_log->dpt, cfg->portsToKnock[0]) == 0)
+	return -1;
+}
+
+
+/*
+ * runs the main loop reading knocks from the syslog file
+ * chosen from logLocations
+ */
+void run_syslog_backend(Config* cfg)
+{
+	//without a saved position only entries written from now on are read
+	if(initialize_log_reader(&_main_log_reader, fileno(cfg->logFile)) == 0)
+	{
+		write_error("Check specified log file for irregularities, failed to start reading at its end");
+		shutdown_port_knocking();
+		return;
+	}
+	
+	//catch up on whatever was written while speakeasy wasn't running
+	firewall_batch_begin();
+	if(resume_log_reader(&_main_log_reader, cfg->logPath, LOG_READER_STATE_FILE, replay_log_entry))
+		parse_log_for_entries(cfg, replay_log_entry);
+	if(finish_processing_pass() == 0)
+		return;
+
+	//watch the log with inotify, if that isn't possible
+	//fall back to checking the file size every interval
+	LogWatcher watcher;
+	if(initialize_log_watcher(&watcher, cfg->logPath) == 0)
+		write_error("Failed to watch log file with inotify, falling back to polling");
+	
+	//save file size and loop
+	int fSize = get_file_size(cfg->logPath);
+	while(1)
+	{	
+		firewall_batch_begin();
+		
+		if(watcher.fd != -1 && watcher.wd != -1)
+		{
+			//block until the log changes, only wake up every interval
+			//while there are hosts knocking that might time out
+			int status = wait_for_log_activity(&watcher, knock_wait_timeout_ms(cfg), _main_signal_fd);
+			
+			if(status == LOG_WATCH_MODIFIED)
+				parse_log_for_entries(cfg, process_log_entry);
+			else if(status == LOG_WATCH_REPLACED)
 			{
-				//are they new
-				if(does_hostnode_exist(_main_head_node, _main_log->src) == 0)
-					start_monitoring_host(_main_log->src);
+				//the old file is drained before moving on, if the
+				//new file isn't there yet it gets picked up by polling
+				parse_log_for_entries(cfg, process_log_entry);
+				add_log_watch(&watcher, cfg->logPath);
 			}
-			else
+			else if(status == LOG_WATCH_ERROR)
+			{
+				write_warning("Inotify watcher failed, falling back to polling");
+				free_log_watcher(&watcher);
+			}
+			fSize = get_file_size(cfg->logPath);
+		}
+		else
+		{
+			//a signal still cuts the interval short
+			struct pollfd wake = {.fd = _main_signal_fd, .events = POLLIN};
+			poll(&wake, 1, (cfg->interval + 999) / 1000);
+			
+			//no point in searching if file hasn't changed, a rotated
+			//or truncated file changes the size at the path as well
+			if(fSize != get_file_size(cfg->logPath))
 			{
-				//are they already in the chain
-				if(does_hostnode_exist(_main_head_node, _main_log->src) == 1)
-					update_host_status(_main_log->src, _main_log->dpt);
+				parse_log_for_entries(cfg, process_log_entry);
+				fSize = get_file_size(cfg->logPath);
 			}
-						
-			//free last parsed log
-			free_log(currLog);
-			currLog = NULL;
+			
+			//the watch was lost to a rotation, pick the new file up once it is there
+			if(watcher.fd != -1 && add_log_watch(&watcher, cfg->logPath))
+			{
+				parse_log_for_entries(cfg, process_log_entry);
+				fSize = get_file_size(cfg->logPath);
+			}
+		}
+		
+		if(finish_processing_pass() == 0)
+		{
+			free_log_watcher(&watcher);
+			return;
+		}
+	}
+}
+
+
+/*
+ * runs the main loop reading knocks straight from the kernel
+ * through the NFLOG group the logging rules send packets to
+ */
+void run_nflog_backend(Config* cfg)
+{
+	int fd = open_nflog_socket(cfg->nflogGroup);
+	if(fd == -1)
+	{
+		write_error("Check that nfnetlink_log is available and nflogGroup is unused");
+		shutdown_port_knocking();
+		return;
+	}
+	
+	//the signal fd wakes the loop up as well
+	struct pollfd pfds[2] = {{.fd = fd, .events = POLLIN}, {.fd = _main_signal_fd, .events = POLLIN}};
+	while(1)
+	{
+		firewall_batch_begin();
+		
+		//the kernel batches packets, so one wakeup usually carries several knocks
+		int ready = poll(pfds, 2, knock_wait_timeout_ms(cfg));
+		
+		if(ready > 0 && pfds[0].revents != 0 && read_nflog_entries(fd, process_log_entry) == -1)
+		{
+			write_error("Failed to read from nflog socket");
+			_main_stop_requested = 1;
+		}
+		
+		if(finish_processing_pass() == 0)
+		{
+			close(fd);
+			return;
+		}
+	}
+}
+
+
+/*
+ * runs the main loop reading knocks from the kernel messages in the
+ * systemd journal, for hosts where journald is the only logger
+ */
+void run_journal_backend(Config* cfg)
+{
+	if(open_journal_reader(&_main_journal_reader, cfg->journalDirectory) == 0)
+	{
+		write_error("Check that the systemd journal is readable, or set journalDirectory to a journal directory");
+		shutdown_port_knocking();
+		return;
+	}
+	
+	if(resume_journal_reader(&_main_journal_reader, JOURNAL_CURSOR_FILE))
+		write_log("Resuming journal from saved cursor");
+	
+	while(1)
+	{
+		firewall_batch_begin();
+		
+		//anything written since the last pass is read before blocking again
+		if(read_journal_entries(&_main_journal_reader, process_log_entry) == -1)
+		{
+			write_error("Failed to read from the journal");
+			_main_stop_requested = 1;
+		}
+		save_journal_cursor_throttled(&_main_journal_reader, JOURNAL_CURSOR_FILE);
+		
+		if(finish_processing_pass() == 0)
+			return;
+		
+		//the pass is already finished so there is nothing left to commit
+		if(wait_for_journal(&_main_journal_reader, knock_wait_timeout_ms(cfg), _main_signal_fd) == -1)
+		{
+			write_error("Failed to wait for journal changes");
+			shutdown_port_knocking();
+			return;
 		}
 	}
 }
 
 
+/*
+ * runs the main loop reading SYNs to the knock ports from a packet
+ * ring, knocks are seen as they arrive instead of after a log flush
+ */
+void run_packet_backend(Config* cfg)
+{
+	PacketRing* ring = &_main_packet_ring;
+	if(open_packet_ring(ring, cfg->knockProgram) == 0)
+	{
+		write_error("Check that portsToKnock is set and packet sockets are available");
+		shutdown_port_knocking();
+		return;
+	}
+	
+	//the signal fd wakes the loop up as well
+	struct pollfd pfds[2] = {{.fd = ring->fd, .events = POLLIN | POLLERR}, {.fd = _main_signal_fd, .events = POLLIN}};
+	while(1)
+	{
+		firewall_batch_begin();
+		
+		//woken once per retired block rather than once per packet
+		if(poll(pfds, 2, knock_wait_timeout_ms(cfg)) > 0 && pfds[0].revents != 0)
+			read_packet_ring(ring, process_log_entry);
+		
+		if(finish_processing_pass() == 0)
+			return;
+	}
+}
+
+
 /*
  * this function contains the main logic loop
  * that runs the port knocking server
@@ -270,43 +1188,57 @@ void initialize_port_knocking()
 	fclose(cfgFptr);
 	if(cfg == NULL)
 	{
-		write_log("Check config.txt for issues, delete config.txt to regenerate");
+		write_error("Check config.txt for issues, delete config.txt to regenerate");
 		return;
 	}
 	
-	//set global pointers _main_cfg to cfg
-	//and _main_head_node to a sentinel node
+	//set global pointer _main_cfg to cfg and set up the host table
 	_main_cfg = cfg;
-	HostNode* head = construct_hostnode(NULL, NULL, NULL);
-	_main_head_node = head;
-	
-	//set up firewall with cfg and whitelist, then close whitelist
-	setup_firewall(cfg);
+	set_log_level(cfg->logLevel);
+	if(initialize_host_table(&_main_host_table, HOST_TABLE_INITIAL_SIZE) == 0)
+	{
+		write_error("Failed to allocate host table");
+		return;
+	}
+	initialize_timer_wheel(&_main_timer_wheel, timer_current_tick());
 	
-	//skip to last line in file
-	if(skip_to_last_line(cfg->logFile) == 0)
+	//knocks are checked against the whitelist in memory from here on
+	if(initialize_whitelist(&_main_whitelist, WHITELIST_INITIAL_SIZE) == 0)
 	{
-		write_log("Check specified log file for irregularities, failed to skip to end");
-		signal_handler(SIGTERM);
+		write_error("Failed to allocate whitelist");
+		return;
 	}
+	if(load_whitelist(&_main_whitelist, cfg->whitelistFile) != 0)
+		write_warning("Some lines of whitelist.txt aren't addresses or cidr ranges and were skipped");
 	
-	//save file size and loop
-	unsigned int fSize = 0;
-	while(1)
-	{	
-		//no point in searching if file hasn't changed
-		if(fSize != get_file_size(cfg->logPath))
-		{
-			parse_log_for_entries(cfg);
-			fSize = get_file_size(cfg->logPath);
-		}
-		
-		//if there are active hosts knocking check them for timeout
-		if(count_hostlist(_main_head_node) > 0)
-			check_hostlist_for_timeouts();
-		
-		usleep(cfg->interval);
+	//changes made while the last run was up are still in the journal
+	if(open_whitelist_journal(&_main_whitelist_journal, &_main_whitelist) == 0)
+	{
+		write_error("Failed to open " WHITELIST_JOURNAL_FILE);
+		return;
 	}
+	
+	//set up firewall with cfg and whitelist
+	check_firewall_requirements(cfg);
+	setup_firewall(cfg);
+	apply_whitelist();
+	
+	//nftables changes go over netlink and never wait on the xtables lock
+	if(cfg->firewallBackend == FIREWALL_BACKEND_IPTABLES && start_firewall_executor() == 0)
+		write_error("Failed to start firewall executor, firewall changes are applied in the main loop");
+	
+	//speakeasy-ctl changes the whitelist and knocking hosts without a restart
+	if(open_control_socket(&_control_socket, CONTROL_SOCKET_FILE) == 0)
+		write_error("Failed to open " CONTROL_SOCKET_FILE ", speakeasy-ctl can't reach this server");
+	
+	if(cfg->logBackend == LOG_BACKEND_NFLOG)
+		run_nflog_backend(cfg);
+	else if(cfg->logBackend == LOG_BACKEND_PACKET)
+		run_packet_backend(cfg);
+	else if(cfg->logBackend == LOG_BACKEND_JOURNAL)
+		run_journal_backend(cfg);
+	else
+		run_syslog_backend(cfg);
 }
 
 
@@ -316,6 +1248,20 @@ int main(int argc, char *argv[])
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
 	
+	//SIGUSR1 does nothing but wake the main loop for a speakeasy-ctl request
+	signal(SIGUSR1, signal_handler);
+	
+	//SIGHUP reloads config.txt without a restart
+	signal(SIGHUP, signal_handler);
+	
+	//from here on they are only seen between passes
+	if(open_signal_fd() == 0)
+		write_warning("Failed to open signal fd, a signal right before a wait is only seen after it");
+	
+	//messages are written by a thread of their own from here on
+	if(start_logger() == 0)
+		write_warning("Failed to start logging thread, messages are written as they come");
+	
 	//verifies privileges and dependencies
 	check_requirements();	
 	
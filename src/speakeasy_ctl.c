@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+//has to match CONTROL_SOCKET_FILE in control.h
+#define CONTROL_SOCKET_FILE "speakeasy.sock"
+#define CONTROL_REQUEST_SIZE 256
+
+
+/*
+ * prints how to use speakeasy-ctl
+ */
+void print_usage()
+{
+	fprintf(stderr, "usage: speakeasy-ctl [-s socket] command [argument]\n\n");
+	fprintf(stderr, "commands:\n");
+	fprintf(stderr, "  list-tracked-hosts          hosts in the middle of a knock sequence\n");
+	fprintf(stderr, "  show-host address           whether a host is whitelisted or knocking\n");
+	fprintf(stderr, "  whitelist-add entry         whitelist an address or cidr range\n");
+	fprintf(stderr, "  whitelist-remove entry      take an address or cidr range off the whitelist\n");
+	fprintf(stderr, "  revoke address              make a host knock again to get back in\n");
+	fprintf(stderr, "  flush-knocking              forget every host that is knocking\n");
+	fprintf(stderr, "  stats                       counters and latencies in the prometheus format\n\n");
+	fprintf(stderr, "the socket defaults to " CONTROL_SOCKET_FILE " in the current directory,\n");
+	fprintf(stderr, "run it from the directory speakeasy runs in\n");
+}
+
+
+/*
+ * connects to the control socket at path,
+ * returns the socket or -1 if it couldn't connect
+ */
+int connect_control_socket(const char* path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+
+	if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * sends one request line and prints the response, the first line of it
+ * tells whether the command worked and the rest is its output,
+ * returns the exit status
+ */
+int run_request(int fd, const char* request)
+{
+	size_t length = strlen(request);
+	for(size_t sent = 0; sent < length; )
+	{
+		ssize_t len = write(fd, request + sent, length - sent);
+		if(len == -1 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return 2;
+		sent += len;
+	}
+
+	//the server closes the connection once the response is out
+	char buffer[4096];
+	unsigned int firstLine = 1;
+	int status = 2;
+	ssize_t len;
+
+	while((len = read(fd, buffer, sizeof(buffer))) != 0)
+	{
+		if(len == -1 && errno == EINTR)
+			continue;
+		if(len == -1)
+			return 2;
+
+		char* data = buffer;
+
+		//"ok" is dropped, an error goes to stderr as it is
+		if(firstLine)
+		{
+			firstLine = 0;
+			char* newline = memchr(buffer, '\n', len);
+			size_t lineLength = (newline != NULL) ? newline - buffer + 1 : (size_t) len;
+
+			if(lineLength >= 2 && strncmp(buffer, "ok", 2) == 0)
+				status = 0;
+			else
+			{
+				fwrite(buffer, 1, lineLength, stderr);
+				status = 1;
+			}
+
+			data += lineLength;
+			len -= lineLength;
+		}
+
+		fwrite(data, 1, len, stdout);
+	}
+
+	return status;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char* path = CONTROL_SOCKET_FILE;
+	int first = 1;
+
+	if(argc > 2 && strcmp(argv[1], "-s") == 0)
+	{
+		path = argv[2];
+		first = 3;
+	}
+
+	if(argc - first < 1 || argc - first > 2)
+	{
+		print_usage();
+		return 2;
+	}
+
+	char request[CONTROL_REQUEST_SIZE];
+	int length = snprintf(request, sizeof(request), "%s%s%s\n", argv[first],
+						  (argc - first == 2) ? " " : "", (argc - first == 2) ? argv[first + 1] : "");
+	if(length < 0 || length >= (int) sizeof(request))
+	{
+		fprintf(stderr, "request is too long\n");
+		return 2;
+	}
+
+	int fd = connect_control_socket(path);
+	if(fd == -1)
+	{
+		fprintf(stderr, "failed to connect to %s: %s\n", path, strerror(errno));
+		return 2;
+	}
+
+	int status = run_request(fd, request);
+	close(fd);
+
+	if(status == 2)
+		fprintf(stderr, "lost connection to %s\n", path);
+	return status;
+}
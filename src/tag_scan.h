@@ -0,0 +1,146 @@
+/*
+ * substring search used to find tagged lines in large chunks of the
+ * log, candidate positions are found by comparing the first and last
+ * byte of the tag against a whole vector of positions at once and
+ * only those are compared in full, the widest variant the cpu
+ * supports is picked the first time a scan runs
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAG_SCAN_X86 1
+#endif
+
+
+/*
+ * returns the first occurrence of tag in buf
+ * or NULL if there isn't one, the plain C version
+ */
+const char* tag_scan_scalar(const char* buf, size_t len, const char* tag, size_t tagLen)
+{
+	if(tagLen == 0 || tagLen > len)
+		return NULL;
+
+	const char* last = buf + len - tagLen;
+
+	while(buf <= last)
+	{
+		buf = memchr(buf, tag[0], last - buf + 1);
+		if(buf == NULL)
+			return NULL;
+
+		if(memcmp(buf + 1, tag + 1, tagLen - 1) == 0)
+			return buf;
+
+		buf++;
+	}
+
+	return NULL;
+}
+
+
+#ifdef TAG_SCAN_X86
+
+/*
+ * the sse2 version of tag_scan_scalar, 16 positions per step
+ */
+__attribute__((target("sse2")))
+const char* tag_scan_sse2(const char* buf, size_t len, const char* tag, size_t tagLen)
+{
+	if(tagLen < 2 || tagLen > len)
+		return tag_scan_scalar(buf, len, tag, tagLen);
+
+	const __m128i first = _mm_set1_epi8(tag[0]);
+	const __m128i last = _mm_set1_epi8(tag[tagLen - 1]);
+	size_t i = 0;
+
+	for(; i + tagLen - 1 + 16 <= len; i += 16)
+	{
+		__m128i blockFirst = _mm_loadu_si128((const __m128i*) (buf + i));
+		__m128i blockLast = _mm_loadu_si128((const __m128i*) (buf + i + tagLen - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+															 _mm_cmpeq_epi8(last, blockLast)));
+
+		while(mask != 0)
+		{
+			unsigned int bit = __builtin_ctz(mask);
+			if(memcmp(buf + i + bit + 1, tag + 1, tagLen - 2) == 0)
+				return buf + i + bit;
+			mask &= mask - 1;
+		}
+	}
+
+	//the tail is shorter than a vector
+	return tag_scan_scalar(buf + i, len - i, tag, tagLen);
+}
+
+
+/*
+ * the avx2 version of tag_scan_scalar, 32 positions per step
+ */
+__attribute__((target("avx2")))
+const char* tag_scan_avx2(const char* buf, size_t len, const char* tag, size_t tagLen)
+{
+	if(tagLen < 2 || tagLen > len)
+		return tag_scan_scalar(buf, len, tag, tagLen);
+
+	const __m256i first = _mm256_set1_epi8(tag[0]);
+	const __m256i last = _mm256_set1_epi8(tag[tagLen - 1]);
+	size_t i = 0;
+
+	for(; i + tagLen - 1 + 32 <= len; i += 32)
+	{
+		__m256i blockFirst = _mm256_loadu_si256((const __m256i*) (buf + i));
+		__m256i blockLast = _mm256_loadu_si256((const __m256i*) (buf + i + tagLen - 1));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+																   _mm256_cmpeq_epi8(last, blockLast)));
+
+		while(mask != 0)
+		{
+			unsigned int bit = __builtin_ctz(mask);
+			if(memcmp(buf + i + bit + 1, tag + 1, tagLen - 2) == 0)
+				return buf + i + bit;
+			mask &= mask - 1;
+		}
+	}
+
+	return tag_scan_sse2(buf + i, len - i, tag, tagLen);
+}
+
+#endif
+
+
+typedef const char* (*TagScanFunction)(const char* buf, size_t len, const char* tag, size_t tagLen);
+
+TagScanFunction _tag_scan_function = NULL;
+
+
+/*
+ * returns the widest tag scan the cpu supports
+ */
+TagScanFunction choose_tag_scan()
+{
+#ifdef TAG_SCAN_X86
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+		return tag_scan_avx2;
+
+	if(__builtin_cpu_supports("sse2"))
+		return tag_scan_sse2;
+#endif
+
+	return tag_scan_scalar;
+}
+
+
+/*
+ * returns the first occurrence of tag in buf
+ * or NULL if there isn't one
+ */
+const char* tag_scan(const char* buf, size_t len, const char* tag, size_t tagLen)
+{
+	if(_tag_scan_function == NULL)
+		_tag_scan_function = choose_tag_scan();
+
+	return _tag_scan_function(buf, len, tag, tagLen);
+}
@@ -0,0 +1,251 @@
+/*
+ * geometry of the timer wheel: TIMER_LEVELS wheels of TIMER_SLOTS
+ * slots each, a slot of level n covers TIMER_SLOTS^n ticks so four
+ * levels reach 2^24 ticks ahead, anything further is parked in the
+ * top level and cascaded down again until it is due
+ */
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+//one tick is 10ms of monotonic time
+#define TIMER_TICK_NS 10000000ULL
+
+
+/*
+ * a scheduled knock timeout, items aren't removed when a host
+ * finishes early, instead the deadline is compared against the
+ * host's current deadline when the item comes due
+ */
+typedef struct
+{
+	uint32_t addr;
+	uint64_t deadline;
+} TimerItem;
+
+
+/*
+ * a growable array of timer items, used for the
+ * slots of the wheel and for batches of expired items
+ */
+typedef struct
+{
+	TimerItem* items;
+	unsigned int count;
+	unsigned int capacity;
+} TimerList;
+
+
+/*
+ * this struct houses the timer wheel:
+ * 	-current is the last tick that was processed
+ * 	-count is the number of items still scheduled
+ * 	-expired collects the items that came due during one advance
+ */
+typedef struct
+{
+	TimerList slots[TIMER_LEVELS][TIMER_SLOTS];
+	TimerList expired;
+	uint64_t current;
+	unsigned int count;
+} TimerWheel;
+
+
+/*
+ * returns the first tick at or after a monotonic time in nanoseconds
+ */
+uint64_t timer_tick_at(uint64_t ns)
+{
+	return (ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+}
+
+
+/*
+ * returns the current time in ticks
+ */
+uint64_t timer_current_tick()
+{
+	return monotonic_ns() / TIMER_TICK_NS;
+}
+
+
+/*
+ * appends an item to a timer list, returns 1 if
+ * successful or 0 if the list couldn't grow
+ */
+unsigned int timer_list_push(TimerList* list, TimerItem* item)
+{
+	if(list->count == list->capacity)
+	{
+		unsigned int capacity = (list->capacity == 0) ? 8 : list->capacity * 2;
+		TimerItem* items = (TimerItem*) realloc(list->items, sizeof(TimerItem) * capacity);
+
+		if(items == NULL)
+			return 0;
+
+		list->items = items;
+		list->capacity = capacity;
+	}
+
+	list->items[list->count++] = *item;
+	return 1;
+}
+
+
+/*
+ * sets up an empty timer wheel starting at tick now
+ */
+void initialize_timer_wheel(TimerWheel* wheel, uint64_t now)
+{
+	if(wheel == NULL)
+		return;
+
+	memset(wheel, 0, sizeof(TimerWheel));
+	wheel->current = now;
+}
+
+
+/*
+ * files an item into the slot matching how far its deadline is
+ * from the current tick, deadlines before earliest are treated as
+ * earliest, returns 1 if successful otherwise 0
+ */
+unsigned int timer_wheel_place(TimerWheel* wheel, TimerItem* item, uint64_t earliest)
+{
+	uint64_t deadline = item->deadline;
+
+	if(deadline < earliest)
+		deadline = earliest;
+
+	uint64_t delta = deadline - wheel->current;
+	unsigned int level = 0;
+
+	while(level < TIMER_LEVELS - 1 && delta >= ((uint64_t) 1 << (TIMER_SLOT_BITS * (level + 1))))
+		level++;
+
+	//too far ahead for the wheel, park it in the furthest top level slot
+	uint64_t range = (uint64_t) 1 << (TIMER_SLOT_BITS * TIMER_LEVELS);
+	if(delta >= range)
+		deadline = wheel->current + range - 1;
+
+	unsigned int slot = (deadline >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+	return timer_list_push(&wheel->slots[level][slot], item);
+}
+
+
+/*
+ * schedules a timeout for addr at tick deadline,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int timer_wheel_schedule(TimerWheel* wheel, uint32_t addr, uint64_t deadline)
+{
+	if(wheel == NULL)
+		return 0;
+
+	TimerItem item = {.addr = addr, .deadline = deadline};
+
+	//an empty wheel isn't advanced while the daemon is idle, so it
+	//catches up here rather than walking every missed tick later
+	uint64_t now = timer_current_tick();
+	if(wheel->count == 0 && now > wheel->current)
+		wheel->current = now;
+
+	//the current tick was already processed so a deadline that
+	//already passed fires on the next one
+	if(timer_wheel_place(wheel, &item, wheel->current + 1) == 0)
+		return 0;
+
+	wheel->count++;
+	return 1;
+}
+
+
+/*
+ * moves the items of a higher level slot down the wheel
+ * now that they are closer to being due, this happens before
+ * the bottom slot of the current tick is emptied so items due
+ * right now still make it
+ */
+void timer_wheel_cascade(TimerWheel* wheel, unsigned int level)
+{
+	unsigned int slot = (wheel->current >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+	TimerList* list = &wheel->slots[level][slot];
+
+	//detach the list first since items may land in the same slot again
+	TimerList pending = *list;
+	memset(list, 0, sizeof(TimerList));
+
+	for(unsigned int i = 0; i < pending.count; i++)
+	{
+		if(timer_wheel_place(wheel, &pending.items[i], wheel->current) == 0)
+			wheel->count--;
+	}
+
+	free(pending.items);
+}
+
+
+/*
+ * processes every tick up to now and returns the items that came
+ * due as one batch, only the slots of those ticks are touched,
+ * the batch stays valid until the next call
+ */
+TimerList* timer_wheel_advance(TimerWheel* wheel, uint64_t now)
+{
+	if(wheel == NULL)
+		return NULL;
+
+	wheel->expired.count = 0;
+
+	//nothing to visit, just catch up
+	if(wheel->count == 0 && now > wheel->current)
+		wheel->current = now;
+
+	while(wheel->current < now)
+	{
+		wheel->current++;
+
+		//cascade from the highest level whose slot boundary was reached
+		unsigned int level = 0;
+		while(level < TIMER_LEVELS - 1 &&
+			  ((wheel->current >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK) == 0)
+			level++;
+
+		for(; level > 0; level--)
+			timer_wheel_cascade(wheel, level);
+
+		//whatever is in the current bottom slot is due
+		TimerList* list = &wheel->slots[0][wheel->current & TIMER_SLOT_MASK];
+
+		for(unsigned int i = 0; i < list->count; i++)
+			timer_list_push(&wheel->expired, &list->items[i]);
+
+		wheel->count -= list->count;
+		list->count = 0;
+
+		if(wheel->count == 0)
+			wheel->current = now;
+	}
+
+	return &wheel->expired;
+}
+
+
+/*
+ * destroys every list of a timer wheel
+ */
+void free_timer_wheel(TimerWheel* wheel)
+{
+	if(wheel == NULL)
+		return;
+
+	for(unsigned int level = 0; level < TIMER_LEVELS; level++)
+	{
+		for(unsigned int slot = 0; slot < TIMER_SLOTS; slot++)
+			free(wheel->slots[level][slot].items);
+	}
+
+	free(wheel->expired.items);
+	memset(wheel, 0, sizeof(TimerWheel));
+}
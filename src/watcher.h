@@ -0,0 +1,147 @@
+/*
+ * these are the results wait_for_log_activity can hand back
+ * to the main loop so it knows what happened to the log file
+ */
+#define LOG_WATCH_ERROR -1
+#define LOG_WATCH_TIMEOUT 0
+#define LOG_WATCH_MODIFIED 1
+#define LOG_WATCH_REPLACED 2
+
+
+/*
+ * this struct houses an inotify watch on the monitored log file:
+ * 	-fd is the inotify instance or -1 if inotify is unavailable
+ * 	-wd is the watch on the log file or -1 if the file went away
+ */
+typedef struct
+{
+	int fd;
+	int wd;
+} LogWatcher;
+
+
+/*
+ * attempts to (re)attach a watch to the file at path, this is
+ * needed after the file is rotated since inotify watches follow
+ * the inode and not the name, returns 1 if successful otherwise 0
+ */
+unsigned int add_log_watch(LogWatcher* watcher, char* path)
+{
+	if(watcher == NULL || path == NULL || watcher->fd == -1)
+		return 0;
+
+	watcher->wd = inotify_add_watch(watcher->fd, path,
+									IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+
+	if(watcher->wd == -1)
+		return 0;
+
+	return 1;
+}
+
+
+/*
+ * sets up an inotify watcher for the log file at path,
+ * returns 1 if successful, otherwise 0 which means
+ * the caller should fall back to polling the file size
+ */
+unsigned int initialize_log_watcher(LogWatcher* watcher, char* path)
+{
+	if(watcher == NULL)
+		return 0;
+
+	watcher->fd = -1;
+	watcher->wd = -1;
+
+	if(path == NULL)
+		return 0;
+
+	watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watcher->fd == -1)
+		return 0;
+
+	//some filesystems (network mounts, procfs etc.) refuse watches
+	if(add_log_watch(watcher, path) == 0)
+	{
+		close(watcher->fd);
+		watcher->fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * blocks until the log file is written to, moved, deleted, wakeFd
+ * becomes readable or until timeoutMs has passed, a timeout of -1
+ * blocks indefinitely and a wakeFd of -1 is left out
+ *
+ * returns LOG_WATCH_MODIFIED if data was appended, LOG_WATCH_REPLACED
+ * if the file was moved or deleted (the watch is dropped and must be
+ * re-added), LOG_WATCH_TIMEOUT if nothing happened and LOG_WATCH_ERROR
+ * if the watcher can't be used anymore
+ */
+int wait_for_log_activity(LogWatcher* watcher, int timeoutMs, int wakeFd)
+{
+	if(watcher == NULL || watcher->fd == -1)
+		return LOG_WATCH_ERROR;
+
+	struct pollfd pfds[2] = {{.fd = watcher->fd, .events = POLLIN}, {.fd = wakeFd, .events = POLLIN}};
+	int ready = poll(pfds, 2, timeoutMs);
+
+	//interrupted by a signal is treated like a timeout
+	if(ready == -1 && errno == EINTR)
+		return LOG_WATCH_TIMEOUT;
+
+	if(ready == -1)
+		return LOG_WATCH_ERROR;
+
+	//being woken up is treated like a timeout as well
+	if(pfds[0].revents == 0)
+		return LOG_WATCH_TIMEOUT;
+
+	//drain every queued event, several writes are coalesced into one wakeup
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int status = LOG_WATCH_TIMEOUT;
+	ssize_t len;
+
+	while((len = read(watcher->fd, buffer, sizeof(buffer))) > 0)
+	{
+		for(char* ptr = buffer; ptr < buffer + len; )
+		{
+			struct inotify_event* event = (struct inotify_event*) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			//skip leftovers from a watch that was already dropped
+			if(event->wd != watcher->wd)
+				continue;
+
+			if(event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+				status = LOG_WATCH_REPLACED;
+			else if((event->mask & IN_MODIFY) && status != LOG_WATCH_REPLACED)
+				status = LOG_WATCH_MODIFIED;
+		}
+	}
+
+	//the watch on the old inode is useless after a move or delete
+	if(status == LOG_WATCH_REPLACED && watcher->wd != -1)
+	{
+		inotify_rm_watch(watcher->fd, watcher->wd);
+		watcher->wd = -1;
+	}
+	return status;
+}
+
+
+/*
+ * destroys a log watcher by closing the inotify instance
+ */
+void free_log_watcher(LogWatcher* watcher)
+{
+	if(watcher == NULL || watcher->fd == -1)
+		return;
+
+	close(watcher->fd);
+	watcher->fd = -1;
+	watcher->wd = -1;
+}
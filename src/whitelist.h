@@ -0,0 +1,724 @@
+#define WHITELIST_FILE "whitelist.txt"
+
+/*
+ * changes to the whitelist are appended to the journal, once it grows
+ * past WHITELIST_COMPACT_SIZE it is moved aside to the old journal
+ * while a fresh snapshot of whitelist.txt is written in the background
+ */
+#define WHITELIST_JOURNAL_FILE "whitelist.journal"
+#define WHITELIST_JOURNAL_OLD_FILE "whitelist.journal.old"
+#define WHITELIST_COMPACT_SIZE (64 * 1024)
+
+//how long a snapshot that failed to write waits before it is tried again
+#define WHITELIST_COMPACT_RETRY_NS (10 * NS_PER_SECOND)
+
+//must be a power of two, the set doubles whenever it is half full
+#define WHITELIST_INITIAL_SIZE 64
+
+
+/*
+ * a whitelisted cidr range, both in network byte order
+ */
+typedef struct
+{
+	uint32_t network;
+	uint32_t mask;
+} WhitelistRange;
+
+
+/*
+ * this struct houses every whitelisted address in memory so knocks
+ * never have to read whitelist.txt:
+ * 	-single addresses are kept in an open addressed hash set,
+ * 	 slots use the same empty, used and deleted states as the host table
+ * 	-cidr ranges are few so they are checked one by one
+ */
+typedef struct
+{
+	uint32_t* addrs;
+	unsigned char* states;
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int deleted;
+	WhitelistRange* ranges;
+	unsigned int numRanges;
+} Whitelist;
+
+
+/*
+ * allocates an empty whitelist with room for capacity addresses,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must free whitelist with free_whitelist
+ */
+unsigned int initialize_whitelist(Whitelist* whitelist, unsigned int capacity)
+{
+	if(whitelist == NULL)
+		return 0;
+
+	memset(whitelist, 0, sizeof(Whitelist));
+	whitelist->addrs = (uint32_t*) calloc(capacity, sizeof(uint32_t));
+	whitelist->states = (unsigned char*) calloc(capacity, sizeof(unsigned char));
+
+	if(whitelist->addrs == NULL || whitelist->states == NULL)
+	{
+		free(whitelist->addrs);
+		free(whitelist->states);
+		return 0;
+	}
+
+	whitelist->capacity = capacity;
+	return 1;
+}
+
+
+/*
+ * destroys a whitelist
+ */
+void free_whitelist(Whitelist* whitelist)
+{
+	if(whitelist == NULL)
+		return;
+
+	free(whitelist->addrs);
+	free(whitelist->states);
+	free(whitelist->ranges);
+	memset(whitelist, 0, sizeof(Whitelist));
+}
+
+
+/*
+ * returns the slot holding addr or the empty slot its probe ended on
+ */
+unsigned int whitelist_probe(Whitelist* whitelist, uint32_t addr)
+{
+	unsigned int mask = whitelist->capacity - 1;
+	unsigned int i = hash_ipv4(addr) & mask;
+
+	while(whitelist->states[i] != HOST_SLOT_EMPTY)
+	{
+		if(whitelist->states[i] == HOST_SLOT_USED && whitelist->addrs[i] == addr)
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+
+/*
+ * returns 1 if addr itself is whitelisted, ranges aren't considered
+ */
+unsigned int whitelist_has_address(Whitelist* whitelist, uint32_t addr)
+{
+	if(whitelist == NULL || whitelist->addrs == NULL)
+		return 0;
+
+	return whitelist->states[whitelist_probe(whitelist, addr)] == HOST_SLOT_USED;
+}
+
+
+/*
+ * returns 1 if addr is whitelisted on its own or by a range
+ */
+unsigned int whitelist_contains(Whitelist* whitelist, uint32_t addr)
+{
+	if(whitelist_has_address(whitelist, addr))
+		return 1;
+
+	for(unsigned int i = 0; whitelist != NULL && i < whitelist->numRanges; i++)
+	{
+		if((addr & whitelist->ranges[i].mask) == whitelist->ranges[i].network)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * moves every address into a set with newCapacity slots,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int resize_whitelist(Whitelist* whitelist, unsigned int newCapacity)
+{
+	Whitelist resized;
+	if(initialize_whitelist(&resized, newCapacity) == 0)
+		return 0;
+
+	for(unsigned int i = 0; i < whitelist->capacity; i++)
+	{
+		if(whitelist->states[i] != HOST_SLOT_USED)
+			continue;
+
+		unsigned int slot = whitelist_probe(&resized, whitelist->addrs[i]);
+		resized.addrs[slot] = whitelist->addrs[i];
+		resized.states[slot] = HOST_SLOT_USED;
+		resized.count++;
+	}
+
+	free(whitelist->addrs);
+	free(whitelist->states);
+	whitelist->addrs = resized.addrs;
+	whitelist->states = resized.states;
+	whitelist->capacity = resized.capacity;
+	whitelist->count = resized.count;
+	whitelist->deleted = 0;
+	return 1;
+}
+
+
+/*
+ * adds a single address to the whitelist,
+ * returns 1 if successful otherwise 0
+ */
+unsigned int whitelist_add_address(Whitelist* whitelist, uint32_t addr)
+{
+	if(whitelist == NULL || whitelist->addrs == NULL)
+		return 0;
+
+	//keep at least a quarter of the slots empty so probes stay short
+	if((whitelist->count + whitelist->deleted + 1) * 4 > whitelist->capacity * 3)
+	{
+		unsigned int newCapacity = whitelist->capacity;
+		if((whitelist->count + 1) * 2 > whitelist->capacity)
+			newCapacity *= 2;
+
+		if(resize_whitelist(whitelist, newCapacity) == 0)
+			return 0;
+	}
+
+	unsigned int slot = whitelist_probe(whitelist, addr);
+	if(whitelist->states[slot] == HOST_SLOT_USED)
+		return 1;
+
+	whitelist->addrs[slot] = addr;
+	whitelist->states[slot] = HOST_SLOT_USED;
+	whitelist->count++;
+	return 1;
+}
+
+
+/*
+ * removes a single address from the whitelist
+ */
+void whitelist_remove_address(Whitelist* whitelist, uint32_t addr)
+{
+	if(whitelist == NULL || whitelist->addrs == NULL)
+		return;
+
+	unsigned int slot = whitelist_probe(whitelist, addr);
+	if(whitelist->states[slot] != HOST_SLOT_USED)
+		return;
+
+	whitelist->states[slot] = HOST_SLOT_DELETED;
+	whitelist->count--;
+	whitelist->deleted++;
+}
+
+
+/*
+ * adds an entry of whitelist.txt,
+ * returns 1 if successful or 0 if it isn't valid
+ */
+unsigned int whitelist_add_entry(Whitelist* whitelist, char* entry)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(entry, &addr, &mask) == 0)
+		return 0;
+
+	if(mask == 0xffffffffu)
+		return whitelist_add_address(whitelist, addr);
+
+	for(unsigned int i = 0; i < whitelist->numRanges; i++)
+	{
+		if(whitelist->ranges[i].network == addr && whitelist->ranges[i].mask == mask)
+			return 1;
+	}
+
+	WhitelistRange* ranges = (WhitelistRange*) realloc(whitelist->ranges,
+							 sizeof(WhitelistRange) * (whitelist->numRanges + 1));
+	if(ranges == NULL)
+		return 0;
+
+	ranges[whitelist->numRanges].network = addr;
+	ranges[whitelist->numRanges].mask = mask;
+	whitelist->ranges = ranges;
+	whitelist->numRanges++;
+	return 1;
+}
+
+
+/*
+ * removes an entry of whitelist.txt, a range is only
+ * removed by the exact same range and not by addresses in it,
+ * returns 1 if successful or 0 if it isn't valid
+ */
+unsigned int whitelist_remove_entry(Whitelist* whitelist, char* entry)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(entry, &addr, &mask) == 0)
+		return 0;
+
+	if(mask == 0xffffffffu)
+	{
+		whitelist_remove_address(whitelist, addr);
+		return 1;
+	}
+
+	for(unsigned int i = 0; i < whitelist->numRanges; i++)
+	{
+		if(whitelist->ranges[i].network == addr && whitelist->ranges[i].mask == mask)
+		{
+			whitelist->ranges[i] = whitelist->ranges[--whitelist->numRanges];
+			break;
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+ * returns 1 if an entry of whitelist.txt is whitelisted as it is,
+ * a range only by the exact same range, otherwise 0
+ */
+unsigned int whitelist_has_entry(Whitelist* whitelist, char* entry)
+{
+	uint32_t addr, mask;
+	if(parse_whitelist_entry(entry, &addr, &mask) == 0)
+		return 0;
+
+	if(mask == 0xffffffffu)
+		return whitelist_has_address(whitelist, addr);
+
+	for(unsigned int i = 0; i < whitelist->numRanges; i++)
+	{
+		if(whitelist->ranges[i].network == addr && whitelist->ranges[i].mask == mask)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * writes an address and mask as an entry of whitelist.txt, the
+ * address alone if the mask covers all of it, otherwise in cidr notation
+ */
+void format_whitelist_entry(uint32_t addr, uint32_t mask, char* text, size_t size)
+{
+	char network[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr, network, sizeof(network));
+
+	if(mask == 0xffffffffu)
+		snprintf(text, size, "%s", network);
+	else
+		snprintf(text, size, "%s/%d", network, __builtin_popcount(mask));
+}
+
+
+/*
+ * writes the entry cursor points at into text and moves cursor on,
+ * cursor starts at 0 and walks the addresses and then the ranges,
+ * returns 1 if there was an entry or 0 once all of them were seen
+ */
+unsigned int whitelist_next_entry(Whitelist* whitelist, unsigned int* cursor, char* text, size_t size)
+{
+	for(; *cursor < whitelist->capacity; (*cursor)++)
+	{
+		if(whitelist->states[*cursor] == HOST_SLOT_USED)
+		{
+			inet_ntop(AF_INET, &whitelist->addrs[(*cursor)++], text, size);
+			return 1;
+		}
+	}
+
+	unsigned int range = *cursor - whitelist->capacity;
+	if(range >= whitelist->numRanges)
+		return 0;
+
+	format_whitelist_entry(whitelist->ranges[range].network, whitelist->ranges[range].mask, text, size);
+	(*cursor)++;
+	return 1;
+}
+
+
+/*
+ * fills a whitelist from every line of a whitelist file,
+ * returns the number of lines that weren't valid entries
+ *
+ * side effect: rewinds the file pointer
+ */
+unsigned int load_whitelist(Whitelist* whitelist, FILE* fptr)
+{
+	if(whitelist == NULL || fptr == NULL)
+		return 0;
+
+	rewind(fptr);
+
+	char* line = NULL;
+	size_t len = 0;
+	unsigned int invalid = 0;
+
+	while(getline(&line, &len, fptr) != -1)
+	{
+		if(line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if(whitelist_add_entry(whitelist, line) == 0)
+			invalid++;
+	}
+
+	free(line);
+	rewind(fptr);
+	return invalid;
+}
+
+
+/*
+ * returns every entry of a whitelist as the text of whitelist.txt,
+ * NULL if it couldn't be allocated
+ *
+ * side effect: must free returned pointer
+ */
+char* format_whitelist_snapshot(Whitelist* whitelist, size_t* length)
+{
+	//each entry fits in a cidr string and a newline
+	size_t capacity = (size_t) (whitelist->count + whitelist->numRanges + 1) * (INET_ADDRSTRLEN + 4);
+	char* snapshot = (char*) malloc(capacity);
+	if(snapshot == NULL)
+		return NULL;
+
+	char text[INET_ADDRSTRLEN + 4];
+	unsigned int cursor = 0;
+	*length = 0;
+
+	while(whitelist_next_entry(whitelist, &cursor, text, sizeof(text)))
+		*length += snprintf(snapshot + *length, capacity - *length, "%s\n", text);
+
+	return snapshot;
+}
+
+
+/*
+ * replaces whitelist.txt with a snapshot, the snapshot is synced
+ * before it is renamed over the old file so a crash leaves one of the
+ * two intact, returns 1 if successful otherwise 0
+ */
+unsigned int write_whitelist_snapshot(const char* snapshot, size_t length)
+{
+	int fd = open(WHITELIST_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd == -1)
+		return 0;
+
+	size_t written = 0;
+	while(written < length)
+	{
+		ssize_t bytes = write(fd, snapshot + written, length - written);
+		if(bytes == -1 && errno == EINTR)
+			continue;
+		if(bytes <= 0)
+			break;
+		written += bytes;
+	}
+
+	if(written != length || fsync(fd) == -1 || close(fd) == -1)
+	{
+		close(fd);
+		unlink(WHITELIST_FILE ".tmp");
+		return 0;
+	}
+
+	if(rename(WHITELIST_FILE ".tmp", WHITELIST_FILE) == -1)
+	{
+		unlink(WHITELIST_FILE ".tmp");
+		return 0;
+	}
+
+	//make the rename itself durable
+	int dirFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dirFd != -1)
+	{
+		fsync(dirFd);
+		close(dirFd);
+	}
+
+	return 1;
+}
+
+
+/*
+ * this struct houses the whitelist journal:
+ * 	-fd is the journal opened for appending and size how big it is
+ * 	-unsynced counts the records written since the last fsync
+ * 	-snapshot is handed to the compactor thread, which sets done
+ * 	 when it is finished, compacting is set while it runs
+ * 	-retryNs is when a snapshot that failed to write is tried again
+ */
+typedef struct
+{
+	int fd;
+	off_t size;
+	unsigned int unsynced;
+	pthread_t compactor;
+	unsigned int compacting;
+	int done;
+	int status;
+	char* snapshot;
+	size_t snapshotLength;
+	uint64_t retryNs;
+} WhitelistJournal;
+
+
+/*
+ * applies every record of a journal file to the whitelist, returns
+ * 1 if the file existed and held records, otherwise 0
+ */
+unsigned int replay_whitelist_journal(Whitelist* whitelist, const char* path)
+{
+	FILE* fptr = read_file(path);
+	if(fptr == NULL)
+		return 0;
+
+	char* line = NULL;
+	size_t len = 0;
+	unsigned int records = 0;
+
+	//a torn last record from a crash simply doesn't parse
+	while(getline(&line, &len, fptr) != -1)
+	{
+		if(line[0] == '+')
+			records += whitelist_add_entry(whitelist, line + 1);
+		else if(line[0] == '-')
+			records += whitelist_remove_entry(whitelist, line + 1);
+	}
+
+	free(line);
+	fclose(fptr);
+	return records > 0;
+}
+
+
+/*
+ * opens the whitelist journal for appending, records left over from
+ * the last run are applied to the whitelist first and folded into a
+ * new snapshot so every run starts with an empty journal,
+ * returns 1 if successful otherwise 0
+ *
+ * side effect: must close journal with close_whitelist_journal
+ */
+unsigned int open_whitelist_journal(WhitelistJournal* journal, Whitelist* whitelist)
+{
+	if(journal == NULL || whitelist == NULL)
+		return 0;
+
+	memset(journal, 0, sizeof(WhitelistJournal));
+	journal->fd = -1;
+
+	//the old journal was written before the current one
+	unsigned int replayed = replay_whitelist_journal(whitelist, WHITELIST_JOURNAL_OLD_FILE);
+	replayed |= replay_whitelist_journal(whitelist, WHITELIST_JOURNAL_FILE);
+
+	if(replayed)
+	{
+		size_t length;
+		char* snapshot = format_whitelist_snapshot(whitelist, &length);
+		unsigned int written = snapshot != NULL && write_whitelist_snapshot(snapshot, length);
+		free(snapshot);
+
+		if(written == 0)
+			return 0;
+	}
+
+	unlink(WHITELIST_JOURNAL_OLD_FILE);
+	journal->fd = open(WHITELIST_JOURNAL_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	return journal->fd != -1;
+}
+
+
+/*
+ * appends one add ('+') or remove ('-') record for entry to the
+ * journal, it reaches the disk with the next whitelist_journal_sync
+ * returns 1 if successful otherwise 0
+ */
+unsigned int whitelist_journal_append(WhitelistJournal* journal, char op, char* entry)
+{
+	if(journal == NULL || journal->fd == -1 || entry == NULL)
+		return 0;
+
+	char record[INET_ADDRSTRLEN + 8];
+	int length = snprintf(record, sizeof(record), "%c%s\n", op, entry);
+	if(length <= 0 || (size_t) length >= sizeof(record))
+		return 0;
+
+	//one write with O_APPEND so records never interleave or tear in memory
+	ssize_t written;
+	do
+		written = write(journal->fd, record, length);
+	while(written == -1 && errno == EINTR);
+
+	if(written != length)
+		return 0;
+
+	journal->size += length;
+	journal->unsynced++;
+	return 1;
+}
+
+
+/*
+ * flushes every record appended since the last call with one
+ * fdatasync, returns 1 if successful otherwise 0
+ */
+unsigned int whitelist_journal_sync(WhitelistJournal* journal)
+{
+	if(journal == NULL || journal->fd == -1 || journal->unsynced == 0)
+		return 1;
+
+	journal->unsynced = 0;
+	return fdatasync(journal->fd) == 0;
+}
+
+
+/*
+ * writes the snapshot handed over by whitelist_journal_compact, once
+ * it is in place the old journal it replaces can go
+ */
+void* whitelist_compactor(void* arg)
+{
+	WhitelistJournal* journal = (WhitelistJournal*) arg;
+
+	int status = write_whitelist_snapshot(journal->snapshot, journal->snapshotLength);
+	if(status)
+		unlink(WHITELIST_JOURNAL_OLD_FILE);
+
+	__atomic_store_n(&journal->status, status, __ATOMIC_RELAXED);
+	__atomic_store_n(&journal->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+/*
+ * collects a finished compactor thread, returns 0 if it
+ * failed to write the snapshot otherwise 1
+ */
+unsigned int whitelist_journal_reap(WhitelistJournal* journal, unsigned int wait)
+{
+	if(journal->compacting == 0)
+		return 1;
+
+	if(wait == 0 && __atomic_load_n(&journal->done, __ATOMIC_ACQUIRE) == 0)
+		return 1;
+
+	pthread_join(journal->compactor, NULL);
+	free(journal->snapshot);
+	journal->snapshot = NULL;
+	journal->compacting = 0;
+	return journal->status;
+}
+
+
+/*
+ * hands the snapshot to the compactor thread, without a thread it
+ * is simply written right away, returns 1 if successful otherwise 0
+ */
+unsigned int start_whitelist_compactor(WhitelistJournal* journal)
+{
+	journal->done = 0;
+	journal->compacting = 1;
+
+	if(start_thread(&journal->compactor, whitelist_compactor, journal))
+		return 1;
+
+	journal->compacting = 0;
+	whitelist_compactor(journal);
+	free(journal->snapshot);
+	journal->snapshot = NULL;
+
+	if(journal->status == 0)
+		journal->retryNs = monotonic_ns() + WHITELIST_COMPACT_RETRY_NS;
+	return journal->status;
+}
+
+
+/*
+ * once the journal is past WHITELIST_COMPACT_SIZE it is moved aside
+ * and a snapshot of the whitelist is written in the background, new
+ * records go to a fresh journal meanwhile, at startup the snapshot
+ * and both journals are replayed in order so a crash at any point
+ * loses nothing, a snapshot that failed to write is tried again every
+ * WHITELIST_COMPACT_RETRY_NS, returns 1 if successful otherwise 0
+ */
+unsigned int whitelist_journal_compact(WhitelistJournal* journal, Whitelist* whitelist)
+{
+	if(journal == NULL || journal->fd == -1)
+		return 0;
+
+	if(whitelist_journal_reap(journal, 0) == 0)
+	{
+		write_error("Failed to write whitelist snapshot, " WHITELIST_JOURNAL_OLD_FILE " is kept until it can be");
+		journal->retryNs = monotonic_ns() + WHITELIST_COMPACT_RETRY_NS;
+	}
+
+	if(journal->compacting)
+		return 1;
+
+	//a journal left over from a failed compaction stays until a snapshot
+	//written from the whitelist covers it, the current journal isn't moved
+	//aside again since replaying its records over that snapshot changes nothing
+	if(access(WHITELIST_JOURNAL_OLD_FILE, F_OK) == 0)
+	{
+		if(monotonic_ns() < journal->retryNs)
+			return 1;
+
+		journal->retryNs = monotonic_ns() + WHITELIST_COMPACT_RETRY_NS;
+		journal->snapshot = format_whitelist_snapshot(whitelist, &journal->snapshotLength);
+		if(journal->snapshot == NULL)
+			return 0;
+
+		return start_whitelist_compactor(journal);
+	}
+
+	if(journal->size < WHITELIST_COMPACT_SIZE)
+		return 1;
+
+	//everything the snapshot reflects has to be on disk before the journal is moved aside
+	journal->snapshot = format_whitelist_snapshot(whitelist, &journal->snapshotLength);
+	if(journal->snapshot == NULL || whitelist_journal_sync(journal) == 0 ||
+	   rename(WHITELIST_JOURNAL_FILE, WHITELIST_JOURNAL_OLD_FILE) == -1)
+	{
+		free(journal->snapshot);
+		journal->snapshot = NULL;
+		return 0;
+	}
+
+	int fd = open(WHITELIST_JOURNAL_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	if(fd == -1)
+	{
+		rename(WHITELIST_JOURNAL_OLD_FILE, WHITELIST_JOURNAL_FILE);
+		free(journal->snapshot);
+		journal->snapshot = NULL;
+		return 0;
+	}
+
+	close(journal->fd);
+	journal->fd = fd;
+	journal->size = 0;
+	return start_whitelist_compactor(journal);
+}
+
+
+/*
+ * waits for a running compaction, flushes and closes the journal
+ */
+void close_whitelist_journal(WhitelistJournal* journal)
+{
+	if(journal == NULL || journal->fd == -1)
+		return;
+
+	whitelist_journal_reap(journal, 1);
+	whitelist_journal_sync(journal);
+	close(journal->fd);
+	journal->fd = -1;
+}